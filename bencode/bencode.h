@@ -35,6 +35,41 @@ namespace cppdatalib
         {
             std::unique_ptr<char []> buffer;
 
+            // Skips the contents of the list or dictionary just begun, up to and including its closing 'e'
+            void skip_current_value()
+            {
+                size_t depth = 1;
+
+                while (depth > 0)
+                {
+                    int chr = stream().get();
+                    core::int_t size;
+
+                    switch (chr)
+                    {
+                        case EOF: throw core::error("Bencode - unexpected end of stream");
+                        case 'l':
+                        case 'd': ++depth; break;
+                        case 'e': --depth; break;
+                        case 'i':
+                            while (chr = stream().get(), chr != 'e')
+                                if (chr == EOF)
+                                    throw core::error("Bencode - invalid 'integer' value");
+                            break;
+                        default:
+                            if (!isdigit(chr))
+                                throw core::error("Bencode - expected value");
+
+                            stream().unget();
+                            stream() >> size;
+                            if (!stream() || size < 0) throw core::error("Bencode - expected string size");
+                            if (stream().get() != ':') throw core::error("Bencode - expected ':' separating string size and data");
+                            if (!core::skip_bytes(stream(), size)) throw core::error("Bencode - unexpected end of string");
+                            break;
+                    }
+                }
+            }
+
         public:
             parser(core::istream_handle input)
                 : core::stream_parser(input)
@@ -78,9 +113,19 @@ namespace cppdatalib
                         break;
                     case 'l':
                         get_output()->begin_array(core::array_t(), core::stream_handler::unknown_size);
+                        if (get_output()->skip_requested())
+                        {
+                            skip_current_value();
+                            get_output()->end_array(core::array_t());
+                        }
                         break;
                     case 'd':
                         get_output()->begin_object(core::object_t(), core::stream_handler::unknown_size);
+                        if (get_output()->skip_requested())
+                        {
+                            skip_current_value();
+                            get_output()->end_object(core::object_t());
+                        }
                         break;
                     default:
                         if (isdigit(chr))
@@ -93,7 +138,12 @@ namespace cppdatalib
                             if (stream().get() != ':') throw core::error("Bencode - expected ':' separating string size and data");
 
                             get_output()->begin_string(core::string_t(), size);
-                            while (size > 0)
+                            if (get_output()->skip_requested())
+                            {
+                                if (!core::skip_bytes(stream(), size))
+                                    throw core::error("Bencode - unexpected end of string");
+                            }
+                            else while (size > 0)
                             {
                                 core::int_t buffer_size = std::min(core::int_t(core::buffer_size), size);
                                 stream().read(buffer.get(), buffer_size);
@@ -93,7 +93,8 @@ namespace cppdatalib
             std::stack<container_data, std::vector<container_data>> containers;
             bool written;
 
-            uint32_t read_size(core::istream &input)
+            // If `length` is not NULL, it is set to the number of bytes the size specifier occupies
+            uint32_t read_size(core::istream &input, uint32_t *length = NULL)
             {
                 uint32_t size = 0;
                 int chr = input.get();
@@ -101,6 +102,8 @@ namespace cppdatalib
                     throw core::error("Binn - expected size specifier");
 
                 size = chr;
+                if (length)
+                    *length = chr >> 7? 4: 1;
                 if (chr >> 7) // If topmost bit is set, the size is specified in 4 bytes, not 1. The topmost bit is not included in the size
                 {
                     size &= 0x7f;
@@ -141,13 +144,19 @@ namespace cppdatalib
                 int chr;
                 core::uint_t integer;
 
-                while (containers.size() > 0 && !get_output()->container_key_was_just_parsed() && containers.top().remaining_size == 0)
+                if (containers.size() > 0 && !get_output()->container_key_was_just_parsed() && containers.top().remaining_size == 0)
                 {
-                    if (get_output()->current_container() == core::array)
-                        get_output()->end_array(core::value(core::array_t(), containers.top().sub_type));
-                    else if (get_output()->current_container() == core::object)
-                        get_output()->end_object(core::value(core::object_t(), containers.top().sub_type));
-                    containers.pop();
+                    while (containers.size() > 0 && !get_output()->container_key_was_just_parsed() && containers.top().remaining_size == 0)
+                    {
+                        if (get_output()->current_container() == core::array)
+                            get_output()->end_array(core::value(core::array_t(), containers.top().sub_type));
+                        else if (get_output()->current_container() == core::object)
+                            get_output()->end_object(core::value(core::object_t(), containers.top().sub_type));
+                        containers.pop();
+                    }
+
+                    if (containers.empty()) // The outermost container was just ended
+                        return;
                 }
 
                 if (containers.size() > 0)
@@ -170,10 +179,7 @@ namespace cppdatalib
                                 integer = (integer << 8) | chr;
                             }
 
-                            bool negative = integer >> 31;
-                            if (negative)
-                                integer = (~integer + 1) & INT32_MAX;
-                            get_output()->write(negative? -core::int_t(integer): core::int_t(integer));
+                            get_output()->write(core::int_t(int32_t(uint32_t(integer))));
                         }
                         else // String keys
                         {
@@ -233,10 +239,7 @@ namespace cppdatalib
                         {
                             case int8:
                             {
-                                bool negative = chr >> 7;
-                                if (negative)
-                                    chr = (~core::uint_t(chr) + 1) & INT8_MAX;
-                                get_output()->write(negative? -chr: chr);
+                                get_output()->write(core::int_t(int8_t(uint8_t(chr))));
                                 break;
                             }
                             case uint8: get_output()->write(core::uint_t(chr)); break;
@@ -257,10 +260,7 @@ namespace cppdatalib
                         {
                             case int16:
                             {
-                                bool negative = integer >> 15;
-                                if (negative)
-                                    integer = (~integer + 1) & INT16_MAX;
-                                get_output()->write(negative? -core::int_t(integer): core::int_t(integer));
+                                get_output()->write(core::int_t(int16_t(uint16_t(integer))));
                                 break;
                             }
                             case uint16: get_output()->write(integer); break;
@@ -281,10 +281,7 @@ namespace cppdatalib
                         {
                             case int32:
                             {
-                                bool negative = integer >> 31;
-                                if (negative)
-                                    integer = (~integer + 1) & INT32_MAX;
-                                get_output()->write(negative? -core::int_t(integer): core::int_t(integer));
+                                get_output()->write(core::int_t(int32_t(uint32_t(integer))));
                                 break;
                             }
                             case uint32: get_output()->write(integer); break;
@@ -306,10 +303,7 @@ namespace cppdatalib
                         {
                             case int64:
                             {
-                                bool negative = integer >> 63;
-                                if (negative)
-                                    integer = ~integer + 1;
-                                get_output()->write(negative? -core::int_t(integer): core::int_t(integer));
+                                get_output()->write(core::int_t(integer));
                                 break;
                             }
                             case uint64: get_output()->write(integer); break;
@@ -333,7 +327,12 @@ namespace cppdatalib
                         }
 
                         get_output()->begin_string(string_type, size);
-                        while (size > 0)
+                        if (get_output()->skip_requested())
+                        {
+                            if (!core::skip_bytes(stream(), size))
+                                throw core::error("Binn - unexpected end of string");
+                        }
+                        else while (size > 0)
                         {
                             core::int_t buffer_size = std::min(core::int_t(core::buffer_size), core::int_t(size));
                             stream().read(buffer.get(), buffer_size);
@@ -364,7 +363,12 @@ namespace cppdatalib
                         }
 
                         get_output()->begin_string(string_type, size);
-                        while (size > 0)
+                        if (get_output()->skip_requested())
+                        {
+                            if (!core::skip_bytes(stream(), size))
+                                throw core::error("Binn - unexpected end of string");
+                        }
+                        else while (size > 0)
                         {
                             core::int_t buffer_size = std::min(core::int_t(core::buffer_size), core::int_t(size));
                             stream().read(buffer.get(), buffer_size);
@@ -383,8 +387,10 @@ namespace cppdatalib
                     case container:
                     {
                         core::subtype_t sub_type = core::normal;
-                        read_size(stream()); // Read size and discard
-                        uint32_t count = read_size(stream()); // Then read element count
+                        uint32_t size_length, count_length;
+                        const uint32_t size = read_size(stream(), &size_length); // The size includes the whole container header
+                        uint32_t count = read_size(stream(), &count_length); // Then read element count
+                        const uint32_t header_length = 1 + ((chr & 0x10) != 0) + size_length + count_length;
 
                         core::value container;
 
@@ -400,7 +406,21 @@ namespace cppdatalib
                             get_output()->begin_object(container, count);
                         else
                             get_output()->begin_array(container, count);
-                        containers.push(container_data(sub_type, count));
+
+                        if (get_output()->skip_requested()) // The contents can be skipped using the container size
+                        {
+                            if (size < header_length)
+                                throw core::error("Binn - invalid container size");
+                            else if (!core::skip_bytes(stream(), size - header_length))
+                                throw core::error("Binn - unexpected end of container");
+
+                            if (container.is_object())
+                                get_output()->end_object(container);
+                            else
+                                get_output()->end_array(container);
+                        }
+                        else
+                            containers.push(container_data(sub_type, count));
                         break;
                     }
                 }
@@ -413,6 +433,9 @@ namespace cppdatalib
         {
             class stream_writer_base : public core::stream_handler, public core::stream_writer
             {
+            protected:
+                core::impl::encoded_size_cache container_sizes;
+
             public:
                 stream_writer_base(core::ostream_handle &output) : core::stream_writer(output) {}
 
@@ -455,175 +478,160 @@ namespace cppdatalib
                                  .put( size        & 0xff);
                 }
 
-                size_t get_size(const core::value &v)
+                // Returns the number of bytes needed to write the type specifier of a value with the given subtype
+                static size_t get_type_size(core::subtype_t subtype)
+                {
+                    return 1 + (subtype >= core::user && subtype - core::user > 15);
+                }
+
+                // Returns the number of bytes needed to encode `size` with write_size()
+                static size_t get_size_specifier_size(uint64_t size)
+                {
+                    return size < 128? 1: 4;
+                }
+
+                // Returns the encoded size of a scalar (or string) value that is not an object key
+                static size_t get_scalar_size(const core::value &v)
+                {
+                    switch (v.get_type())
+                    {
+                        case core::null:
+                            return get_type_size(v.get_subtype());
+                        case core::boolean:
+                            return 1; // The boolean subtype is always written as `yes` or `no`
+                        case core::integer:
+                        {
+                            const core::int_t i = v.get_int_unchecked();
+                            size_t size = get_type_size(v.get_subtype());
+
+                            if (i >= INT8_MIN && i <= INT8_MAX)
+                                return size + 1;
+                            else if (i >= INT16_MIN && i <= INT16_MAX)
+                                return size + 2;
+                            else if (i >= INT32_MIN && i <= INT32_MAX)
+                                return size + 4;
+                            return size + 8;
+                        }
+                        case core::uinteger:
+                        {
+                            const core::uint_t u = v.get_uint_unchecked();
+                            size_t size = get_type_size(v.get_subtype());
+
+                            if (u <= UINT8_MAX)
+                                return size + 1;
+                            else if (u <= UINT16_MAX)
+                                return size + 2;
+                            else if (u <= UINT32_MAX)
+                                return size + 4;
+                            return size + 8;
+                        }
+                        case core::real:
+                            // A user-specified subtype is not available for reals
+                            // (because when the data is read again, the IEEE-754 representation will be put into an integer instead of a real,
+                            // since there is nothing to show that the data should be read as a floating point number)
+                            // To prevent the loss of data, the subtype is discarded and the value stays the same
+                            if (core::float_from_ieee_754(core::float_to_ieee_754(static_cast<float>(v.get_real_unchecked()))) == v.get_real_unchecked() || std::isnan(v.get_real_unchecked()))
+                                return 5; // one byte for type specifier, four bytes for data
+                            return 9; // requires more than 32-bit float to losslessly encode
+                        case core::string:
+                        {
+                            size_t size = get_size_specifier_size(v.string_size()) + v.string_size();
+
+                            switch (v.get_subtype())
+                            {
+                                case core::date:
+                                case core::time:
+                                case core::datetime:
+                                case core::bignum:
+                                    return 1 + size + 1; // trailing nul
+                                case core::blob:
+                                case core::clob:
+                                    return 1 + size;
+                                default:
+                                    return get_type_size(v.get_subtype()) + size + 1; // trailing nul
+                            }
+                        }
+                        default:
+                            return 0;
+                    }
+                }
+
+                // Returns the encoded size of `v` (including the container header), which must be an array or object.
+                // The sizes of all nested containers are computed at the same time, and stored for when they are written
+                uint64_t get_size(const core::value &v)
                 {
                     struct traverser
                     {
                     private:
-                        std::stack<size_t, std::vector<size_t>> size;
+                        core::impl::encoded_size_cache &cache;
+                        std::vector<size_t> containers;
 
                     public:
-                        traverser() {size.push(0);}
-
-                        size_t get_size() const {return size.top();}
+                        traverser(core::impl::encoded_size_cache &cache) : cache(cache) {}
 
                         bool operator()(const core::value *arg, core::value::traversal_ancestry_finder, bool prefix)
                         {
-                            switch (arg->get_type())
+                            if (arg->is_array() || arg->is_object())
                             {
-                                case core::null:
-                                case core::boolean:
-                                    if (prefix)
-                                        size.top() += 1 + (arg->get_subtype() >= core::user && arg->get_subtype() > 15);
-                                    break;
-                                case core::integer:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.top() += 1; // one byte for type specifier
-
-                                        if (arg->get_subtype() >= core::user && arg->get_subtype() > 15)
-                                            ++size.top(); // type specifier requires another byte
-
-                                        if (arg->get_int_unchecked() >= INT8_MIN && arg->get_int_unchecked() <= UINT8_MAX)
-                                            size.top() += 1;
-                                        else if (arg->get_int_unchecked() >= INT16_MIN && arg->get_int_unchecked() <= UINT16_MAX)
-                                            size.top() += 2;
-                                        else if (arg->get_int_unchecked() >= INT32_MIN && arg->get_int_unchecked() <= UINT32_MAX)
-                                            size.top() += 4;
-                                        else
-                                            size.top() += 8;
-                                    }
-
-                                    break;
-                                }
-                                case core::uinteger:
+                                if (prefix)
                                 {
-                                    if (prefix)
-                                    {
-                                        size.top() += 1; // one byte for type specifier
-
-                                        if (arg->get_subtype() >= core::user && arg->get_subtype() > 15)
-                                            ++size.top(); // type specifier requires another byte
-
-                                        if (arg->get_uint_unchecked() <= UINT8_MAX)
-                                            size.top() += 1;
-                                        else if (arg->get_uint_unchecked() <= UINT16_MAX)
-                                            size.top() += 2;
-                                        else if (arg->get_uint_unchecked() <= UINT32_MAX)
-                                            size.top() += 4;
-                                        else
-                                            size.top() += 8;
-                                    }
-
-                                    break;
-                                }
-                                case core::real:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.top() += 5; // one byte for type specifier, minimum of four bytes for data
-
-                                        // A user-specified subtype is not available for reals
-                                        // (because when the data is read again, the IEEE-754 representation will be put into an integer instead of a real,
-                                        // since there is nothing to show that the data should be read as a floating point number)
-                                        // To prevent the loss of data, the subtype is discarded and the value stays the same
+                                    containers.push_back(cache.add(*arg));
 
-                                        if (core::float_from_ieee_754(core::float_to_ieee_754(static_cast<float>(arg->get_real_unchecked()))) != arg->get_real_unchecked() && !std::isnan(arg->get_real_unchecked()))
-                                            size.top() += 4; // requires more than 32-bit float to losslessly encode
-                                    }
-
-                                    break;
-                                }
-                                case core::string:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.top() += 3; // one byte for the type specifier, one for the minimum size specifier of one byte, one for trailing nul
-
-                                        if (arg->get_subtype() >= core::user && arg->get_subtype() > 15)
-                                            ++size.top(); // type specifier requires another byte
-
-                                        if (size.top() + arg->size() >= 128)
-                                            size.top() += 3; // requires a four-byte size specifier
-
-                                        size.top() += arg->string_size();
-                                    }
-                                    break;
-                                }
-                                case core::array:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.push(3); // one byte for the type specifier,
-                                                      // one for the minimum size specifier of one byte,
-                                                      // and one for the minimum count specifier of one byte
+                                    uint64_t &size = cache.size_at(containers.back());
 
-                                        if (arg->get_subtype() >= core::user && arg->get_subtype() > 15)
-                                            ++size.top(); // type specifier requires another byte
+                                    // one byte for the minimum size specifier of one byte, plus the count specifier
+                                    size = 1 + get_size_specifier_size(arg->size());
 
-                                        if (arg->size() >= 128)
-                                            size.top() += 3; // requires a four-byte count specifier
-                                    }
+                                    if (arg->is_array())
+                                        size += get_type_size(arg->get_subtype());
                                     else
                                     {
-                                        if (size.top() >= 128)
-                                            size.top() += 3; // requires a four-byte size specifier
-
-                                        size_t temp = size.top();
-                                        size.pop();
-                                        size.top() += temp;
-                                    }
-
-                                    break;
-                                }
-                                case core::object:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.push(3); // one byte for the type specifier,
-                                                      // one for the minimum size specifier of one byte,
-                                                      // and one for the minimum count specifier of one byte
-
                                         // A user-specified subtype is not available for objects
                                         // (because when the data is read again, there is no way to determine the type of structure the container holds)
                                         // To prevent the loss of data, the subtype is discarded and the value stays the same
+                                        size += 1;
 
-                                        if (arg->size() >= 128)
-                                            size.top() += 3; // requires a four-byte count specifier
-
-                                        // Obtain sizes of keys (ignore values for now, since they'll be added in later invocations)
+                                        // Obtain sizes of keys (values are added in later invocations, since keys are not traversed)
                                         if (arg->get_subtype() == core::map)
-                                            size.top() += 4 * arg->object_size();
+                                            size += 4 * arg->object_size();
                                         else
                                         {
                                             for (auto it = arg->get_object_unchecked().begin(); it != arg->get_object_unchecked().end(); ++it)
-                                                size.top() += 1 /* key size specifier */ + it->first.size() /* key size */;
+                                                size += 1 /* key size specifier */ + it->first.size() /* key size */;
                                         }
                                     }
-                                    else
-                                    {
-                                        if (size.top() >= 128)
-                                            size.top() += 3; // requires a four-byte size specifier
+                                }
+                                else
+                                {
+                                    uint64_t &size = cache.size_at(containers.back());
+                                    containers.pop_back();
 
-                                        size_t temp = size.top();
-                                        size.pop();
-                                        size.top() += temp;
-                                    }
+                                    if (size >= 128)
+                                        size += 3; // requires a four-byte size specifier
 
-                                    break;
+                                    if (!containers.empty())
+                                        cache.size_at(containers.back()) += size;
                                 }
                             }
+                            else if (prefix && !containers.empty())
+                                cache.size_at(containers.back()) += get_scalar_size(*arg);
 
                             return true;
                         }
                     };
 
-                    traverser t;
+                    uint64_t size = 0;
 
-                    v.value_traverse(t);
+                    if (!container_sizes.take(v, size))
+                    {
+                        traverser t(container_sizes);
 
-                    return t.get_size();
+                        container_sizes.clear();
+                        v.value_traverse(t);
+                        container_sizes.take(v, size);
+                    }
+
+                    return size;
                 }
             };
         }
@@ -632,6 +640,98 @@ namespace cppdatalib
         {
             std::stack<core::subtype_t, std::vector<core::subtype_t>> object_types;
 
+            core::ostream &write_int(core::ostream &stream, core::int_t value, core::subtype_t subtype)
+            {
+                const uint64_t out = static_cast<uint64_t>(value); // Two's complement, truncated to the size written below
+
+                if (value >= INT8_MIN && value <= INT8_MAX)
+                    write_type(stream, byte, subtype >= core::user? subtype - core::user: (core::subtype_t) int8)
+                            .put(static_cast<char>(out));
+                else if (value >= INT16_MIN && value <= INT16_MAX)
+                    write_type(stream, word, subtype >= core::user? subtype - core::user: (core::subtype_t) int16)
+                            .put(static_cast<char>(out >> 8))
+                            .put(out & 0xff);
+                else if (value >= INT32_MIN && value <= INT32_MAX)
+                    write_type(stream, dword, subtype >= core::user? subtype - core::user: (core::subtype_t) int32)
+                            .put(static_cast<char>(out >> 24))
+                            .put((out >> 16) & 0xff)
+                            .put((out >> 8) & 0xff)
+                            .put(out & 0xff);
+                else
+                    write_type(stream, qword, subtype >= core::user? subtype - core::user: (core::subtype_t) int64)
+                            .put(out >> 56)
+                            .put((out >> 48) & 0xff)
+                            .put((out >> 40) & 0xff)
+                            .put((out >> 32) & 0xff)
+                            .put((out >> 24) & 0xff)
+                            .put((out >> 16) & 0xff)
+                            .put((out >> 8) & 0xff)
+                            .put(out & 0xff);
+
+                return stream;
+            }
+
+            core::ostream &write_uint(core::ostream &stream, core::uint_t value, core::subtype_t subtype)
+            {
+                uint64_t out = value;
+
+                if (value <= UINT8_MAX)
+                    write_type(stream, byte, subtype >= core::user? subtype - core::user: (core::subtype_t) uint8)
+                            .put(static_cast<char>(out));
+                else if (value <= UINT16_MAX)
+                    write_type(stream, word, subtype >= core::user? subtype - core::user: (core::subtype_t) uint16)
+                            .put(static_cast<char>(out >> 8))
+                            .put(out & 0xff);
+                else if (value <= UINT32_MAX)
+                    write_type(stream, dword, subtype >= core::user? subtype - core::user: (core::subtype_t) uint32)
+                            .put(static_cast<char>(out >> 24))
+                            .put((out >> 16) & 0xff)
+                            .put((out >> 8) & 0xff)
+                            .put(out & 0xff);
+                else
+                    write_type(stream, qword, subtype >= core::user? subtype - core::user: (core::subtype_t) uint64)
+                            .put(out >> 56)
+                            .put((out >> 48) & 0xff)
+                            .put((out >> 40) & 0xff)
+                            .put((out >> 32) & 0xff)
+                            .put((out >> 24) & 0xff)
+                            .put((out >> 16) & 0xff)
+                            .put((out >> 8) & 0xff)
+                            .put(out & 0xff);
+
+                return stream;
+            }
+
+            core::ostream &write_real(core::ostream &stream, core::real_t value)
+            {
+                uint64_t out;
+
+                if (core::float_from_ieee_754(core::float_to_ieee_754(static_cast<float>(value))) == value || std::isnan(value))
+                {
+                    out = core::float_to_ieee_754(static_cast<float>(value));
+                    write_type(stream, dword, single_float)
+                            .put(static_cast<char>(out >> 24))
+                            .put((out >> 16) & 0xff)
+                            .put((out >> 8) & 0xff)
+                            .put(out & 0xff);
+                }
+                else
+                {
+                    out = core::double_to_ieee_754(value);
+                    write_type(stream, qword, double_float)
+                            .put(out >> 56)
+                            .put((out >> 48) & 0xff)
+                            .put((out >> 40) & 0xff)
+                            .put((out >> 32) & 0xff)
+                            .put((out >> 24) & 0xff)
+                            .put((out >> 16) & 0xff)
+                            .put((out >> 8) & 0xff)
+                            .put(out & 0xff);
+                }
+
+                return stream;
+            }
+
         public:
             stream_writer(core::ostream_handle output) : impl::stream_writer_base(output) {}
 
@@ -640,7 +740,7 @@ namespace cppdatalib
             bool requires_object_buffering() const {return true;}
 
         protected:
-            void begin_() {object_types = decltype(object_types)();}
+            void begin_() {object_types = decltype(object_types)(); container_sizes.clear();}
 
             void begin_key_(const core::value &v)
             {
@@ -668,7 +768,7 @@ namespace cppdatalib
                     out = std::abs(key);
                     if (key < 0)
                         out = ~out + 1;
-                    out &= INT32_MAX;
+                    out &= UINT32_MAX;
 
                     stream().put(static_cast<char>(out >> 24))
                                  .put((out >> 16) & 0xff)
@@ -677,74 +777,9 @@ namespace cppdatalib
                     return;
                 }
                 else if (v.is_int())
-                {
-                    core::int_t i = v.get_int_unchecked();
-                    uint64_t out;
-
-                    if (i < -std::numeric_limits<core::int_t>::max())
-                    {
-                        i = uint64_t(INT32_MAX) + 1; // this assignment ensures that the 64-bit write will occur, since the most negative
-                                                     // value is (in binary) 1000...0000
-                        out = 0; // The initial set bit is implied, and ORed in with `0x80 | xxx` later on
-                    }
-                    else
-                    {
-                        i = -i; // Make i positive
-                        out = ~uint64_t(i) + 1;
-                    }
-
-                    if (v.get_int_unchecked() >= INT8_MIN && v.get_int_unchecked() <= INT8_MAX)
-                        write_type(stream(), byte, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) int8)
-                                .put(static_cast<char>(out));
-                    else if (v.get_int_unchecked() >= INT16_MIN && v.get_int_unchecked() <= INT16_MAX)
-                        write_type(stream(), word, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) int16)
-                                .put(static_cast<char>(out >> 8))
-                                .put(out & 0xff);
-                    else if (v.get_int_unchecked() >= INT32_MIN && v.get_int_unchecked() <= INT32_MAX)
-                        write_type(stream(), dword, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) int32)
-                                .put(static_cast<char>(out >> 24))
-                                .put((out >> 16) & 0xff)
-                                .put((out >> 8) & 0xff)
-                                .put(out & 0xff);
-                    else
-                        write_type(stream(), qword, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) int64)
-                                .put(out >> 56)
-                                .put((out >> 48) & 0xff)
-                                .put((out >> 40) & 0xff)
-                                .put((out >> 32) & 0xff)
-                                .put((out >> 24) & 0xff)
-                                .put((out >> 16) & 0xff)
-                                .put((out >> 8) & 0xff)
-                                .put(out & 0xff);
-                }
+                    write_int(stream(), v.get_int_unchecked(), v.get_subtype());
                 else if (v.is_uint())
-                {
-                    uint64_t out = v.get_uint_unchecked();
-
-                    if (v.get_uint_unchecked() <= UINT8_MAX)
-                        write_type(stream(), byte, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) uint8)
-                                .put(static_cast<char>(out));
-                    else if (v.get_uint_unchecked() <= UINT16_MAX)
-                        write_type(stream(), word, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) uint16)
-                                .put(static_cast<char>(out >> 8))
-                                .put(out & 0xff);
-                    else if (v.get_uint_unchecked() <= UINT32_MAX)
-                        write_type(stream(), dword, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) uint32)
-                                .put(static_cast<char>(out >> 24))
-                                .put((out >> 16) & 0xff)
-                                .put((out >> 8) & 0xff)
-                                .put(out & 0xff);
-                    else
-                        write_type(stream(), qword, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) uint64)
-                                .put(out >> 56)
-                                .put((out >> 48) & 0xff)
-                                .put((out >> 40) & 0xff)
-                                .put((out >> 32) & 0xff)
-                                .put((out >> 24) & 0xff)
-                                .put((out >> 16) & 0xff)
-                                .put((out >> 8) & 0xff)
-                                .put(out & 0xff);
-                }
+                    write_uint(stream(), v.get_uint_unchecked(), v.get_subtype());
             }
 
             void null_(const core::value &v) {write_type(stream(), nobytes, v.get_subtype() >= core::user? v.get_subtype() - core::user: (core::subtype_t) null);}
@@ -752,33 +787,7 @@ namespace cppdatalib
 
             /* Integers and UIntegers are handled in begin_scalar_() */
 
-            void real_(const core::value &v)
-            {
-                uint64_t out;
-
-                if (core::float_from_ieee_754(core::float_to_ieee_754(static_cast<float>(v.get_real_unchecked()))) == v.get_real_unchecked() || std::isnan(v.get_real_unchecked()))
-                {
-                    out = core::float_to_ieee_754(static_cast<float>(v.get_real_unchecked()));
-                    write_type(stream(), dword, single_float)
-                            .put(static_cast<char>(out >> 24))
-                            .put((out >> 16) & 0xff)
-                            .put((out >> 8) & 0xff)
-                            .put(out & 0xff);
-                }
-                else
-                {
-                    out = core::double_to_ieee_754(v.get_real_unchecked());
-                    write_type(stream(), qword, double_float)
-                            .put(out >> 56)
-                            .put((out >> 48) & 0xff)
-                            .put((out >> 40) & 0xff)
-                            .put((out >> 32) & 0xff)
-                            .put((out >> 24) & 0xff)
-                            .put((out >> 16) & 0xff)
-                            .put((out >> 8) & 0xff)
-                            .put(out & 0xff);
-                }
-            }
+            void real_(const core::value &v) {write_real(stream(), v.get_real_unchecked());}
 
             void begin_string_(const core::value &v, core::int_t size, bool is_key)
             {
@@ -0,0 +1,423 @@
+/*
+ * binn_view.h
+ *
+ * Copyright © 2017 Oliver Adams
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef CPPDATALIB_BINN_VIEW_H
+#define CPPDATALIB_BINN_VIEW_H
+
+#include "binn.h"
+
+namespace cppdatalib
+{
+    namespace binn
+    {
+        // A lightweight, non-owning view of one Binn-encoded value in memory (e.g. a loaded or memory-mapped buffer).
+        // Only the header of the viewed value is decoded on construction. Containers store their total size,
+        // so elements are located by jumping over whole subtrees without decoding them, and object and map keys
+        // are compared in place. Values are only decoded when accessed.
+        //
+        // The buffer must outlive the view and any views obtained from it.
+        class view
+        {
+            const unsigned char *data_;
+            size_t encoded_size_; // Size in bytes of the entire viewed value
+            size_t header_size_; // Size in bytes of the type specifier, and any size and count specifiers
+            type storage_type_;
+            int subtype_;
+            uint32_t length_; // Number of elements of a container, or size in bytes of a string or blob
+
+            static uint32_t read_size(const unsigned char *&p, const unsigned char *end)
+            {
+                if (p == end)
+                    throw core::error("Binn - expected size specifier");
+
+                uint32_t size = *p++;
+                if (size >> 7) // If topmost bit is set, the size is specified in 4 bytes, not 1. The topmost bit is not included in the size
+                {
+                    if (end - p < 3)
+                        throw core::error("Binn - expected size specifier");
+
+                    size &= 0x7f;
+                    for (int i = 0; i < 3; ++i)
+                        size = (size << 8) | *p++;
+                }
+
+                return size;
+            }
+
+            // Reads a big-endian unsigned integer of `bytes` bytes
+            static uint64_t read_uint(const unsigned char *p, int bytes)
+            {
+                uint64_t result = 0;
+                for (int i = 0; i < bytes; ++i)
+                    result = (result << 8) | p[i];
+                return result;
+            }
+
+            // Sign-extends the lowest `bytes` bytes of `integer`
+            static core::int_t sign_extend(uint64_t integer, int bytes)
+            {
+                const uint64_t sign = uint64_t(1) << (bytes * 8 - 1);
+
+                if (bytes < 8 && (integer & sign))
+                    integer |= ~((sign << 1) - 1);
+                return static_cast<core::int_t>(integer);
+            }
+
+            static int data_size(type storage_type)
+            {
+                switch (storage_type)
+                {
+                    case byte: return 1;
+                    case word: return 2;
+                    case dword: return 4;
+                    case qword: return 8;
+                    default: return 0;
+                }
+            }
+
+            const unsigned char *content() const {return data_ + header_size_;}
+            const unsigned char *content_end() const {return data_ + encoded_size_;}
+
+        public:
+            class const_iterator;
+
+            view()
+                : data_(NULL)
+                , encoded_size_(0)
+                , header_size_(0)
+                , storage_type_(nobytes)
+                , subtype_(null)
+                , length_(0)
+            {}
+
+            // Views the value at the beginning of `data`, which must be no larger than `size` bytes
+            view(const char *data, size_t size)
+                : data_(reinterpret_cast<const unsigned char *>(data))
+                , length_(0)
+            {
+                const unsigned char *p = data_, *end = data_ + size;
+
+                if (p == end)
+                    throw core::error("Binn - unexpected end of buffer, expected type specifier");
+
+                int chr = *p++;
+                storage_type_ = static_cast<type>(chr >> 5);
+                subtype_ = chr & 0xf;
+
+                if (chr & 0x10)
+                {
+                    if (p == end)
+                        throw core::error("Binn - unexpected end of buffer, expected subtype extension");
+                    subtype_ = (subtype_ << 8) | *p++;
+                }
+
+                switch (storage_type_)
+                {
+                    case string:
+                        length_ = read_size(p, end);
+                        header_size_ = p - data_;
+                        encoded_size_ = header_size_ + length_ + 1; // Trailing NUL
+                        break;
+                    case blob:
+                        length_ = read_size(p, end);
+                        header_size_ = p - data_;
+                        encoded_size_ = header_size_ + length_;
+                        break;
+                    case container:
+                        encoded_size_ = read_size(p, end); // The size includes the header
+                        length_ = read_size(p, end);
+                        header_size_ = p - data_;
+                        if (encoded_size_ < header_size_)
+                            throw core::error("Binn - invalid container size");
+                        break;
+                    default:
+                        header_size_ = p - data_;
+                        encoded_size_ = header_size_ + data_size(storage_type_);
+                        break;
+                }
+
+                if (encoded_size_ > size)
+                    throw core::error("Binn - unexpected end of buffer");
+            }
+
+            // Views the value at the beginning of `data`. The string must outlive the view
+            view(const std::string &data) : view(data.data(), data.size()) {}
+
+            bool valid() const {return data_ != NULL;}
+
+            // Returns the encoded bytes of the viewed value
+            const char *data() const {return reinterpret_cast<const char *>(data_);}
+            size_t encoded_size() const {return encoded_size_;}
+
+            core::type get_type() const
+            {
+                if (!valid())
+                    return core::null;
+
+                switch (storage_type_)
+                {
+                    case nobytes: return subtype_ == yes || subtype_ == no? core::boolean: core::null;
+                    case byte:
+                    case word:
+                        return subtype_ == int8? core::integer: core::uinteger; // int8 and int16 have the same subtype code
+                    case dword:
+                        return subtype_ == int32? core::integer: subtype_ == single_float? core::real: core::uinteger;
+                    case qword:
+                        return subtype_ == int64? core::integer: subtype_ == double_float? core::real: core::uinteger;
+                    case string:
+                    case blob:
+                        return core::string;
+                    default: /* container */
+                        return subtype_ == map || subtype_ == object? core::object: core::array;
+                }
+            }
+
+            core::subtype_t get_subtype() const
+            {
+                if (!valid())
+                    return core::normal;
+
+                switch (storage_type_)
+                {
+                    case nobytes: return subtype_ == null || subtype_ == yes || subtype_ == no? (core::subtype_t) core::normal: core::subtype_t(core::user + subtype_);
+                    case byte:
+                    case word:
+                        return subtype_ == int8 || subtype_ == uint8? (core::subtype_t) core::normal: core::subtype_t(core::user + subtype_);
+                    case dword:
+                        return subtype_ == int32 || subtype_ == uint32 || subtype_ == single_float? (core::subtype_t) core::normal: core::subtype_t(core::user + subtype_);
+                    case qword:
+                        return subtype_ == int64 || subtype_ == uint64 || subtype_ == double_float? (core::subtype_t) core::normal: core::subtype_t(core::user + subtype_);
+                    case string:
+                        switch (subtype_)
+                        {
+                            case text: return core::normal;
+                            case datetime: return core::datetime;
+                            case date: return core::date;
+                            case time: return core::time;
+                            case decimal_str: return core::bignum;
+                            default: return core::user + subtype_;
+                        }
+                    case blob: return subtype_ == blob_data? (core::subtype_t) core::blob: core::subtype_t(core::user + subtype_);
+                    default: /* container */
+                        return subtype_ == map? (core::subtype_t) core::map: subtype_ == object || subtype_ == list? (core::subtype_t) core::normal: core::subtype_t(core::user + subtype_);
+                }
+            }
+
+            bool is_null() const {return get_type() == core::null;}
+            bool is_bool() const {return get_type() == core::boolean;}
+            bool is_int() const {return get_type() == core::integer;}
+            bool is_uint() const {return get_type() == core::uinteger;}
+            bool is_real() const {return get_type() == core::real;}
+            bool is_string() const {return get_type() == core::string;}
+            bool is_array() const {return get_type() == core::array;}
+            bool is_object() const {return get_type() == core::object;}
+
+            // Returns the number of elements of a container, the size in bytes of a string, or 0 for other values
+            size_t size() const {return length_;}
+
+            core::bool_t get_bool(core::bool_t default_ = false) const {return is_bool()? subtype_ == yes: default_;}
+            core::int_t get_int(core::int_t default_ = 0) const
+            {
+                if (!is_int())
+                    return default_;
+
+                const int bytes = data_size(storage_type_);
+                return sign_extend(read_uint(content(), bytes), bytes);
+            }
+            core::uint_t get_uint(core::uint_t default_ = 0) const {return is_uint()? read_uint(content(), data_size(storage_type_)): default_;}
+            core::real_t get_real(core::real_t default_ = 0.0) const
+            {
+                if (!is_real())
+                    return default_;
+                else if (storage_type_ == dword)
+                    return core::float_from_ieee_754(static_cast<uint32_t>(read_uint(content(), 4)));
+                return core::double_from_ieee_754(read_uint(content(), 8));
+            }
+            core::string_t get_string(const core::string_t &default_ = core::string_t()) const
+            {
+                return is_string()? core::string_t(reinterpret_cast<const char *>(content()), length_): default_;
+            }
+
+            // Decodes the entire viewed value, including all nested values
+            core::value get_value() const
+            {
+                if (!valid())
+                    return core::value();
+
+                parser p(core::istream_handle(data(), encoded_size_));
+                core::value v;
+                p >> v;
+                return v;
+            }
+
+            // Iterates over the elements of a container. Subtrees that are not accessed are skipped without being decoded
+            const_iterator begin() const;
+            const_iterator end() const;
+
+            // Returns the element at `index` of an array, or an invalid view if there is no such element
+            view element(size_t index) const;
+
+            // Returns the value with the string key `key` in an object, or an invalid view if there is no such key
+            view member(const core::string_t &key) const;
+
+            // Returns the value with the integer key `key` in a map, or an invalid view if there is no such key
+            view member(core::int_t key) const;
+
+            view operator[](const core::string_t &key) const {return member(key);}
+        };
+
+        class view::const_iterator
+        {
+            friend class view;
+
+            // The parent container is described by value, so iterators remain valid after the view they came from is destroyed
+            const unsigned char *end_; // End of the parent's content
+            type parent_storage_type_;
+            int parent_subtype_;
+            uint32_t length_; // Number of elements of the parent
+
+            const unsigned char *pos; // Position of the current element (the key, for objects)
+            uint32_t index;
+            const unsigned char *key_; // Key of the current element, if the parent is an object or map
+            size_t key_size_;
+            view value_;
+
+            const_iterator(const view &parent, const unsigned char *pos, uint32_t index)
+                : end_(parent.content_end())
+                , parent_storage_type_(parent.storage_type_)
+                , parent_subtype_(parent.subtype_)
+                , length_(parent.length_)
+                , pos(pos)
+                , index(index)
+                , key_(NULL)
+                , key_size_(0)
+            {
+                load();
+            }
+
+            void load()
+            {
+                if (index >= length_)
+                    return;
+
+                const unsigned char *p = pos, *end = end_;
+
+                if (parent_storage_type_ == container && parent_subtype_ == map)
+                {
+                    if (end - p < 4)
+                        throw core::error("Binn - expected map key");
+                    key_ = p;
+                    key_size_ = 4;
+                    p += 4;
+                }
+                else if (parent_storage_type_ == container && parent_subtype_ == object)
+                {
+                    if (p == end || size_t(end - p - 1) < *p)
+                        throw core::error("Binn - expected object key");
+                    key_ = p + 1;
+                    key_size_ = *p;
+                    p += 1 + key_size_;
+                }
+
+                value_ = view(reinterpret_cast<const char *>(p), end - p);
+            }
+
+        public:
+            const_iterator() : end_(NULL), parent_storage_type_(nobytes), parent_subtype_(null), length_(0), pos(NULL), index(0), key_(NULL), key_size_(0) {}
+
+            // Returns the key of the current element (a string for objects, an integer for maps, or null for arrays)
+            core::value key() const
+            {
+                if (key_ == NULL)
+                    return core::null_t();
+                else if (parent_subtype_ == map)
+                    return sign_extend(read_uint(key_, 4), 4);
+                return core::string_t(reinterpret_cast<const char *>(key_), key_size_);
+            }
+
+            // Returns true if the current element has the string key `key`, without decoding the key
+            bool key_equals(const char *key, size_t size) const
+            {
+                return key_ != NULL && parent_subtype_ != map && key_size_ == size && std::equal(key_, key_ + size, reinterpret_cast<const unsigned char *>(key));
+            }
+
+            const view &operator*() const {return value_;}
+            const view *operator->() const {return &value_;}
+
+            const_iterator &operator++()
+            {
+                pos = value_.data_ + value_.encoded_size_;
+                ++index;
+                key_ = NULL;
+                load();
+                return *this;
+            }
+            const_iterator operator++(int) {const_iterator temp(*this); ++*this; return temp;}
+
+            bool operator==(const const_iterator &other) const {return end_ == other.end_ && index == other.index;}
+            bool operator!=(const const_iterator &other) const {return !(*this == other);}
+        };
+
+        inline view::const_iterator view::begin() const {return const_iterator(*this, content(), storage_type_ == container? 0: length_);}
+        inline view::const_iterator view::end() const {return const_iterator(*this, content_end(), length_);}
+
+        inline view view::element(size_t index) const
+        {
+            if (!is_array() || index >= length_)
+                return view();
+
+            const_iterator it = begin();
+            while (index-- > 0)
+                ++it;
+            return *it;
+        }
+
+        inline view view::member(const core::string_t &key) const
+        {
+            if (!valid() || storage_type_ != container || subtype_ != object)
+                return view();
+
+            for (const_iterator it = begin(); it != end(); ++it)
+                if (it.key_equals(key.data(), key.size()))
+                    return *it;
+
+            return view();
+        }
+
+        inline view view::member(core::int_t key) const
+        {
+            if (!valid() || storage_type_ != container || subtype_ != map)
+                return view();
+
+            for (const_iterator it = begin(); it != end(); ++it)
+                if (sign_extend(read_uint(it.key_, 4), 4) == key)
+                    return *it;
+
+            return view();
+        }
+    }
+}
+
+#endif // CPPDATALIB_BINN_VIEW_H
@@ -35,6 +35,8 @@ namespace cppdatalib
         {
             class stream_writer_base : public core::stream_handler, public core::stream_writer
             {
+                core::impl::encoded_size_cache container_sizes;
+
             public:
                 stream_writer_base(core::ostream_handle output) : core::stream_writer(output) {}
 
@@ -75,169 +77,100 @@ namespace cppdatalib
                     return stream.write(buffer, buffer_size);
                 }
 
-                size_t get_size(const core::value &v)
+                // Returns the number of bytes needed to encode `size` with write_size(), excluding the type specifier
+                static size_t get_size_specifier_size(uint64_t size)
+                {
+                    if (size >= UINT32_MAX)
+                        return 8;
+                    else if (size >= UINT16_MAX)
+                        return 4;
+                    else if (size >= UINT8_MAX)
+                        return 2;
+                    return 1;
+                }
+
+                // Returns the encoded size of a scalar (or string) value
+                static size_t get_scalar_size(const core::value &v)
+                {
+                    switch (v.get_type())
+                    {
+                        case core::integer:
+                            if (v.get_int_unchecked() < 0)
+                                return 1 + get_size_specifier_size(uint64_t(0) - uint64_t(v.get_int_unchecked()));
+                            else if (v.get_int_unchecked() <= 1)
+                                return 1; // 0 and 1 are shortcut types
+                            return 1 + get_size_specifier_size(v.get_int_unchecked());
+                        case core::uinteger:
+                            if (v.get_uint_unchecked() <= 1)
+                                return 1; // 0 and 1 are shortcut types
+                            return 1 + get_size_specifier_size(v.get_uint_unchecked());
+                        case core::real:
+                            // A user-specified subtype is not available for reals
+                            // (because when the data is read again, the IEEE-754 representation will be put into an integer instead of a real,
+                            // since there is nothing to show that the data should be read as a floating point number)
+                            // To prevent the loss of data, the subtype is discarded and the value stays the same
+                            if (core::float_from_ieee_754(core::float_to_ieee_754(static_cast<float>(v.get_real_unchecked()))) == v.get_real_unchecked() || std::isnan(v.get_real_unchecked()))
+                                return 5; // one byte for type specifier, four bytes for data
+                            return 9; // requires more than 32-bit float to losslessly encode
+                        case core::string:
+                            if (v.string_size() == 0 && v.get_subtype() != core::blob && v.get_subtype() != core::clob)
+                                return 1; // Empty string type
+                            return 1 + get_size_specifier_size(v.string_size()) + v.string_size();
+                        default:
+                            return 1;
+                    }
+                }
+
+                // Returns the encoded size of the contents of `v`, which must be an array or object.
+                // The sizes of all nested containers are computed at the same time, and stored for when they are written
+                uint64_t get_size(const core::value &v)
                 {
                     struct traverser
                     {
                     private:
-                        std::stack<size_t, std::vector<size_t>> size;
+                        core::impl::encoded_size_cache &cache;
+                        std::vector<size_t> containers;
 
                     public:
-                        traverser() {size.push(0);}
-
-                        size_t get_size() const {return size.top();}
+                        traverser(core::impl::encoded_size_cache &cache) : cache(cache) {}
 
                         bool operator()(const core::value *arg, core::value::traversal_ancestry_finder, bool prefix)
                         {
-                            switch (arg->get_type())
+                            if (arg->is_array() || arg->is_object())
                             {
-                                case core::null:
-                                case core::boolean:
-                                    if (prefix)
-                                        size.top() += 1;
-                                    break;
-                                case core::integer:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.top() += 1; // one byte for type specifier
-
-                                        if (arg->get_int_unchecked() == 0 || arg->get_int_unchecked() == 1)
-                                            ; // do nothing
-                                        else if (arg->get_int_unchecked() >= -core::int_t(UINT8_MAX) && arg->get_int_unchecked() <= UINT8_MAX)
-                                            size.top() += 1;
-                                        else if (arg->get_int_unchecked() >= -core::int_t(UINT16_MAX) && arg->get_int_unchecked() <= UINT16_MAX)
-                                            size.top() += 2;
-                                        else if (arg->get_int_unchecked() >= -core::int_t(UINT32_MAX) && arg->get_int_unchecked() <= UINT32_MAX)
-                                            size.top() += 4;
-                                        else
-                                            size.top() += 8;
-                                    }
-
-                                    break;
-                                }
-                                case core::uinteger:
+                                if (prefix)
+                                    containers.push_back(cache.add(*arg));
+                                else
                                 {
-                                    if (prefix)
-                                    {
-                                        size.top() += 1; // one byte for type specifier
-
-                                        if (arg->get_uint_unchecked() == 0 || arg->get_uint_unchecked() == 1)
-                                            ; // do nothing
-                                        else if (arg->get_uint_unchecked() <= UINT8_MAX)
-                                            size.top() += 1;
-                                        else if (arg->get_uint_unchecked() <= UINT16_MAX)
-                                            size.top() += 2;
-                                        else if (arg->get_uint_unchecked() <= UINT32_MAX)
-                                            size.top() += 4;
-                                        else
-                                            size.top() += 8;
-                                    }
-
-                                    break;
-                                }
-                                case core::real:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.top() += 5; // one byte for type specifier, minimum of four bytes for data
-
-                                        // A user-specified subtype is not available for reals
-                                        // (because when the data is read again, the IEEE-754 representation will be put into an integer instead of a real,
-                                        // since there is nothing to show that the data should be read as a floating point number)
-                                        // To prevent the loss of data, the subtype is discarded and the value stays the same
-
-                                        if (core::float_from_ieee_754(core::float_to_ieee_754(static_cast<float>(arg->get_real_unchecked()))) != arg->get_real_unchecked() && !std::isnan(arg->get_real_unchecked()))
-                                            size.top() += 4; // requires more than 32-bit float to losslessly encode
-                                    }
+                                    uint64_t size = cache.size_at(containers.back());
+                                    containers.pop_back();
 
-                                    break;
-                                }
-                                case core::string:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.top() += 1; // one byte for type specifier
-
-                                        if (arg->size() >= UINT32_MAX)
-                                            size.top() += 8; // requires an eight-byte size specifier
-                                        else if (arg->size() >= UINT16_MAX)
-                                            size.top() += 4; // requires a four-byte size specifier
-                                        else if (arg->size() >= UINT8_MAX)
-                                            size.top() += 2; // requires a two-byte size specifier
-                                        else if (arg->size() > 0 && arg->get_subtype() != core::blob && arg->get_subtype() != core::clob)
-                                            size.top() += 1; // requires a one-byte size specifier
-
-                                        size.top() += arg->string_size();
-                                    }
-                                    break;
-                                }
-                                case core::array:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.push(size.size() > 2); // one byte for type specifier
-                                    }
-                                    else
-                                    {
-                                        if (size.size() > 2)
-                                        {
-                                            if (size.top() >= UINT32_MAX)
-                                                size.top() += 8; // requires an eight-byte size specifier
-                                            else if (size.top() >= UINT16_MAX)
-                                                size.top() += 4; // requires a four-byte size specifier
-                                            else if (size.top() >= UINT8_MAX)
-                                                size.top() += 2; // requires a two-byte size specifier
-                                            else
-                                                size.top() += 1; // requires a one-byte size specifier
-                                        }
-
-                                        size_t temp = size.top();
-                                        size.pop();
-                                        size.top() += temp;
-                                    }
-
-                                    break;
-                                }
-                                case core::object:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.push(size.size() > 2); // one byte for type specifier
-                                    }
-                                    else
-                                    {
-                                        if (size.size() > 2)
-                                        {
-                                            if (size.top() >= UINT32_MAX)
-                                                size.top() += 8; // requires an eight-byte size specifier
-                                            else if (size.top() >= UINT16_MAX)
-                                                size.top() += 4; // requires a four-byte size specifier
-                                            else if (size.top() >= UINT8_MAX)
-                                                size.top() += 2; // requires a two-byte size specifier
-                                            else
-                                                size.top() += 1; // requires a one-byte size specifier
-                                        }
-
-                                        size_t temp = size.top();
-                                        size.pop();
-                                        size.top() += temp;
-                                    }
-
-                                    break;
+                                    if (!containers.empty())
+                                        cache.size_at(containers.back()) += 1 + get_size_specifier_size(size) + size;
                                 }
                             }
+                            else if (prefix && !containers.empty())
+                                cache.size_at(containers.back()) += get_scalar_size(*arg);
 
                             return true;
                         }
                     };
 
-                    traverser t;
+                    uint64_t size = 0;
 
-                    v.traverse(t);
+                    if (!container_sizes.take(v, size))
+                    {
+                        traverser t(container_sizes);
 
-                    return t.get_size();
+                        container_sizes.clear();
+                        v.traverse(t);
+                        container_sizes.take(v, size);
+                    }
+
+                    return size;
                 }
+
+                void begin_() {container_sizes.clear();}
             };
         }
 
@@ -0,0 +1,366 @@
+/*
+ * channel.h
+ *
+ * Copyright © 2017 Oliver Adams
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef CPPDATALIB_CHANNEL_H
+#define CPPDATALIB_CHANNEL_H
+
+#include "stream_base.h"
+
+#include <atomic>
+#include <thread>
+#include <cstring>
+
+namespace cppdatalib
+{
+    namespace core
+    {
+        namespace impl
+        {
+            // Tags of the event records sent through a channel. Each record is a tag byte, the subtype of the value, and a payload:
+            //
+            //    - channel_bool: one byte
+            //    - channel_int, channel_uint, channel_real: the value in native byte order
+            //    - channel_string, channel_string_data: a size_t length, followed by the bytes of the string
+            //    - channel_begin_array, channel_begin_object, channel_begin_string: the int_t size passed to begin_xxx()
+            //    - all other records have no payload
+            enum channel_event : uint8_t
+            {
+                channel_null,
+                channel_bool,
+                channel_int,
+                channel_uint,
+                channel_real,
+                channel_string,
+                channel_begin_array,
+                channel_end_array,
+                channel_begin_object,
+                channel_end_object,
+                channel_begin_string,
+                channel_string_data,
+                channel_end_string
+            };
+
+            // Spins briefly, then yields, while a channel is full or empty
+            inline void channel_wait(unsigned int &spins)
+            {
+                if (++spins > 64)
+                    std::this_thread::yield();
+            }
+        }
+
+        // A lock-free single-producer, single-consumer byte ring buffer, used to pass stream events from one thread to another.
+        // One thread writes events with a channel_writer, and another thread reads them with a channel_reader.
+        // The writer blocks while the channel is full, so a slow reader limits how far ahead the writer can get
+        class channel
+        {
+            // The positions are padded onto separate cache lines, so the producer and consumer do not contend for them
+            char padding0[64];
+            std::atomic<size_t> head; // Total number of bytes written, only modified by the producer
+            char padding1[64 - sizeof(std::atomic<size_t>)];
+            std::atomic<size_t> tail; // Total number of bytes read, only modified by the consumer
+            char padding2[64 - sizeof(std::atomic<size_t>)];
+            std::atomic<bool> closed_;
+
+            std::vector<char> buffer;
+            size_t mask;
+
+        public:
+            // Creates a channel that buffers up to `capacity` bytes, rounded up to a power of two
+            explicit channel(size_t capacity = 1 << 20)
+                : head(0)
+                , tail(0)
+                , closed_(false)
+            {
+                size_t size = 64;
+                while (size < capacity)
+                    size *= 2;
+
+                buffer.resize(size);
+                mask = size - 1;
+            }
+
+            channel(const channel &) = delete;
+            channel &operator=(const channel &) = delete;
+
+            size_t capacity() const {return buffer.size();}
+
+            // Producer: writes `size` bytes to the channel, blocking while it is full
+            void write(const char *data, size_t size)
+            {
+                const size_t h = head.load(std::memory_order_relaxed);
+                size_t written = 0;
+                unsigned int spins = 0;
+
+                while (written < size)
+                {
+                    const size_t available = buffer.size() - (h + written - tail.load(std::memory_order_acquire));
+                    if (available == 0)
+                    {
+                        impl::channel_wait(spins);
+                        continue;
+                    }
+
+                    const size_t offset = (h + written) & mask;
+                    const size_t n = std::min(std::min(size - written, available), buffer.size() - offset);
+
+                    memcpy(&buffer[offset], data + written, n);
+                    written += n;
+                    head.store(h + written, std::memory_order_release);
+                    spins = 0;
+                }
+            }
+
+            // Producer: signals that no more bytes will be written
+            void close() {closed_.store(true, std::memory_order_release);}
+
+            // Consumer: reads up to `size` bytes from the channel, blocking while it is empty.
+            // Returns the number of bytes read, which is only 0 if the channel has been closed and all bytes have been read
+            size_t read(char *data, size_t size)
+            {
+                const size_t t = tail.load(std::memory_order_relaxed);
+                unsigned int spins = 0;
+
+                while (true)
+                {
+                    const size_t available = head.load(std::memory_order_acquire) - t;
+                    if (available == 0)
+                    {
+                        // Bytes written before the channel was closed are visible once the close is
+                        if (closed_.load(std::memory_order_acquire) && head.load(std::memory_order_acquire) == t)
+                            return 0;
+
+                        impl::channel_wait(spins);
+                        continue;
+                    }
+
+                    const size_t offset = t & mask;
+                    const size_t n = std::min(std::min(size, available), buffer.size() - offset);
+
+                    memcpy(data, &buffer[offset], n);
+                    tail.store(t + n, std::memory_order_release);
+                    return n;
+                }
+            }
+
+            bool closed() const {return closed_.load(std::memory_order_acquire);}
+        };
+
+        // Encodes stream events into records that are sent through a channel. Records are batched, and only sent when a batch is full,
+        // when a top-level value ends, or when flush() is called. The channel is closed when the writer is closed or destroyed
+        class channel_writer : public stream_handler
+        {
+            channel &ch;
+            std::vector<char> batch;
+            size_t batch_size;
+            bool closed;
+
+            void append(const void *data, size_t size)
+            {
+                if (batch.size() + size > batch_size)
+                {
+                    flush();
+                    if (size >= batch_size)
+                    {
+                        ch.write(static_cast<const char *>(data), size);
+                        return;
+                    }
+                }
+
+                batch.insert(batch.end(), static_cast<const char *>(data), static_cast<const char *>(data) + size);
+            }
+
+            template<typename T>
+            void append_raw(T v) {append(&v, sizeof(v));}
+
+            void record(impl::channel_event event, subtype_t subtype)
+            {
+                append_raw<uint8_t>(event);
+                append_raw(subtype);
+            }
+
+            void append_string(const string_t &s)
+            {
+                append_raw<size_t>(s.size());
+                append(s.data(), s.size());
+            }
+
+        public:
+            // `batch_size` is the number of bytes buffered before they are sent to the channel
+            channel_writer(channel &ch, size_t batch_size = 16384)
+                : ch(ch)
+                , batch_size(std::max(size_t(1), std::min(batch_size, ch.capacity() / 2)))
+                , closed(false)
+            {
+                batch.reserve(this->batch_size);
+            }
+            ~channel_writer() {close();}
+
+            // Sends all buffered records to the channel
+            void flush()
+            {
+                if (!batch.empty())
+                    ch.write(batch.data(), batch.size());
+                batch.clear();
+            }
+
+            // Sends all buffered records and closes the channel, after which the reader finishes once it has read every record
+            void close()
+            {
+                if (!closed)
+                {
+                    flush();
+                    ch.close();
+                    closed = true;
+                }
+            }
+
+        protected:
+            void end_() {flush();}
+
+            bool write_(const value &v, bool)
+            {
+                switch (v.get_type())
+                {
+                    case null: record(impl::channel_null, v.get_subtype()); break;
+                    case boolean: record(impl::channel_bool, v.get_subtype()); append_raw<uint8_t>(v.get_bool_unchecked()); break;
+                    case integer: record(impl::channel_int, v.get_subtype()); append_raw(v.get_int_unchecked()); break;
+                    case uinteger: record(impl::channel_uint, v.get_subtype()); append_raw(v.get_uint_unchecked()); break;
+                    case real: record(impl::channel_real, v.get_subtype()); append_raw(v.get_real_unchecked()); break;
+                    case string: record(impl::channel_string, v.get_subtype()); append_string(v.get_string_unchecked()); break;
+                    default: return false; // Containers are sent as their individual events
+                }
+
+                return true;
+            }
+
+            void begin_array_(const value &v, int_t size, bool) {record(impl::channel_begin_array, v.get_subtype()); append_raw(size);}
+            void end_array_(const value &v, bool) {record(impl::channel_end_array, v.get_subtype());}
+
+            void begin_object_(const value &v, int_t size, bool) {record(impl::channel_begin_object, v.get_subtype()); append_raw(size);}
+            void end_object_(const value &v, bool) {record(impl::channel_end_object, v.get_subtype());}
+
+            void begin_string_(const value &v, int_t size, bool) {record(impl::channel_begin_string, v.get_subtype()); append_raw(size);}
+            void string_data_(const value &v, bool) {record(impl::channel_string_data, v.get_subtype()); append_string(v.get_string_unchecked());}
+            void end_string_(const value &v, bool) {record(impl::channel_end_string, v.get_subtype());}
+        };
+
+        // Decodes the records sent through a channel, and writes the events to its output, one top-level value per call to convert().
+        // Typically used on its own thread, as in `while (reader.wait_for_value()) reader.convert(output);`
+        class channel_reader : public core::stream_input
+        {
+            channel &ch;
+            std::vector<char> buffer;
+            size_t pos, length;
+
+            // Reads more bytes from the channel, returning false if it has been closed and no bytes remain
+            bool fill()
+            {
+                length = ch.read(buffer.data(), buffer.size());
+                pos = 0;
+                return length > 0;
+            }
+
+            void read(void *data, size_t size)
+            {
+                char *out = static_cast<char *>(data);
+
+                while (size > 0)
+                {
+                    if (pos == length && !fill())
+                        throw core::error("cppdatalib::core::channel_reader - unexpected end of channel");
+
+                    const size_t n = std::min(size, length - pos);
+                    memcpy(out, &buffer[pos], n);
+                    pos += n;
+                    out += n;
+                    size -= n;
+                }
+            }
+
+            template<typename T>
+            T read_raw()
+            {
+                T v;
+                read(&v, sizeof(v));
+                return v;
+            }
+
+            string_t read_string()
+            {
+                string_t s(read_raw<size_t>(), '\0');
+                if (!s.empty())
+                    read(&s[0], s.size());
+                return s;
+            }
+
+        public:
+            channel_reader(channel &ch, size_t buffer_size = 16384)
+                : ch(ch)
+                , buffer(std::max(size_t(1), buffer_size))
+                , pos(0)
+                , length(0)
+            {}
+            channel_reader(channel &ch, core::stream_handler &output, size_t buffer_size = 16384)
+                : stream_input(output)
+                , ch(ch)
+                , buffer(std::max(size_t(1), buffer_size))
+                , pos(0)
+                , length(0)
+            {}
+
+            // Blocks until the next record is available, and returns true, or returns false if the channel has been closed and all records have been read
+            bool wait_for_value() {return pos < length || fill();}
+
+            void reset() {}
+
+        protected:
+            void write_one_()
+            {
+                const impl::channel_event event = static_cast<impl::channel_event>(read_raw<uint8_t>());
+                const subtype_t subtype = read_raw<subtype_t>();
+
+                switch (event)
+                {
+                    case impl::channel_null: get_output()->write(core::value(core::null_t(), subtype)); break;
+                    case impl::channel_bool: get_output()->write(core::value(read_raw<uint8_t>() != 0, subtype)); break;
+                    case impl::channel_int: get_output()->write(core::value(read_raw<int_t>(), subtype)); break;
+                    case impl::channel_uint: get_output()->write(core::value(read_raw<uint_t>(), subtype)); break;
+                    case impl::channel_real: get_output()->write(core::value(read_raw<real_t>(), subtype)); break;
+                    case impl::channel_string: get_output()->write(core::value(read_string(), subtype)); break;
+                    case impl::channel_begin_array: get_output()->begin_array(core::value(core::array_t(), subtype), read_raw<int_t>()); break;
+                    case impl::channel_end_array: get_output()->end_array(core::value(core::array_t(), subtype)); break;
+                    case impl::channel_begin_object: get_output()->begin_object(core::value(core::object_t(), subtype), read_raw<int_t>()); break;
+                    case impl::channel_end_object: get_output()->end_object(core::value(core::object_t(), subtype)); break;
+                    case impl::channel_begin_string: get_output()->begin_string(core::value(core::string_t(), subtype), read_raw<int_t>()); break;
+                    case impl::channel_string_data: get_output()->append_to_string(core::value(read_string(), subtype)); break;
+                    case impl::channel_end_string: get_output()->end_string(core::value(core::string_t(), subtype)); break;
+                    default: throw core::error("cppdatalib::core::channel_reader - invalid event record");
+                }
+            }
+        };
+    }
+}
+
+#endif // CPPDATALIB_CHANNEL_H
@@ -32,9 +32,11 @@
 #include "base64.h"
 #include "hex.h"
 #include "fp_convert.h"
-// stream_filters.h includes value_builder.h, stream_base.h, and value.h
+// stream_filters.h includes sketches.h, value_builder.h, stream_base.h, and value.h
 #include "stream_filters.h"
+#include "external_sort.h"
 #include "value_parser.h"
+#include "size_prescan.h"
 #include "dump.h"
 
 #endif // CPPDATALIB_CORE_CORE_H
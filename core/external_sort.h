@@ -0,0 +1,586 @@
+/*
+ * external_sort.h
+ *
+ * Copyright © 2017 Oliver Adams
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef CPPDATALIB_EXTERNAL_SORT_H
+#define CPPDATALIB_EXTERNAL_SORT_H
+
+#include "stream_filters.h"
+#include <cstdio>
+#include <memory>
+
+namespace cppdatalib
+{
+    namespace core
+    {
+        namespace impl
+        {
+            // A temporary file containing a sorted run of values, in a compact binary encoding
+            //
+            // Each value is encoded as a tag byte (the value type, with the high bit set if a subtype follows), an optional 16-bit subtype,
+            // and a payload. Integers are stored as (zigzag-encoded) varints, reals as raw bytes, strings as a varint length followed by
+            // the string data, and arrays and objects as a varint element count followed by the elements (or alternating keys and values)
+            class sort_run_file
+            {
+                FILE *file;
+
+                void put(const char *data, size_t size)
+                {
+                    if (fwrite(data, 1, size, file) != size)
+                        throw core::error("cppdatalib::core::external_sort_filter - unable to write to temporary file");
+                }
+
+                void put_varint(uint64_t v)
+                {
+                    char buffer[10];
+                    size_t size = 0;
+
+                    do
+                    {
+                        buffer[size++] = static_cast<char>((v & 0x7f) | (v > 0x7f? 0x80: 0));
+                        v >>= 7;
+                    } while (v);
+
+                    put(buffer, size);
+                }
+
+                void get(char *data, size_t size)
+                {
+                    if (fread(data, 1, size, file) != size)
+                        throw core::error("cppdatalib::core::external_sort_filter - unexpected end of temporary file");
+                }
+
+                uint64_t get_varint()
+                {
+                    uint64_t v = 0;
+
+                    for (int shift = 0; shift < 64; shift += 7)
+                    {
+                        int c = getc(file);
+                        if (c == EOF)
+                            throw core::error("cppdatalib::core::external_sort_filter - unexpected end of temporary file");
+
+                        v |= uint64_t(c & 0x7f) << shift;
+                        if (!(c & 0x80))
+                            return v;
+                    }
+
+                    throw core::error("cppdatalib::core::external_sort_filter - invalid integer in temporary file");
+                }
+
+                // Writes the type, subtype, and scalar payload or element count of one node of a value
+                void put_node(const core::value &v)
+                {
+                    const char tag = static_cast<char>(v.get_type() | (v.get_subtype() != core::normal? 0x80: 0));
+
+                    put(&tag, 1);
+                    if (v.get_subtype() != core::normal)
+                    {
+                        const uint16_t subtype = static_cast<uint16_t>(v.get_subtype());
+                        const char buffer[2] = {static_cast<char>(subtype >> 8), static_cast<char>(subtype & 0xff)};
+                        put(buffer, 2);
+                    }
+
+                    switch (v.get_type())
+                    {
+                        case core::null: break;
+                        case core::boolean:
+                        {
+                            const char b = v.get_bool_unchecked();
+                            put(&b, 1);
+                            break;
+                        }
+                        case core::integer:
+                        {
+                            const uint64_t i = static_cast<uint64_t>(v.get_int_unchecked());
+                            put_varint((i << 1) ^ (v.get_int_unchecked() < 0? ~uint64_t(0): 0));
+                            break;
+                        }
+                        case core::uinteger: put_varint(v.get_uint_unchecked()); break;
+                        case core::real:
+                        {
+                            const core::real_t r = v.get_real_unchecked();
+                            put(reinterpret_cast<const char *>(&r), sizeof(r));
+                            break;
+                        }
+                        case core::string:
+                            put_varint(v.string_size());
+                            put(v.get_string_unchecked().data(), v.string_size());
+                            break;
+                        case core::array: put_varint(v.array_size()); break;
+                        case core::object: put_varint(v.object_size()); break;
+                    }
+                }
+
+                struct traverse_node_writer
+                {
+                    sort_run_file &file;
+
+                    traverse_node_writer(sort_run_file &file) : file(file) {}
+
+                    bool operator()(const core::value *arg, core::value::traversal_ancestry_finder, bool prefix)
+                    {
+                        if (prefix)
+                            file.put_node(*arg);
+                        return true;
+                    }
+                };
+
+                sort_run_file(const sort_run_file &);
+                void operator=(const sort_run_file &);
+
+            public:
+                sort_run_file(size_t buffer_size = 256 * 1024)
+                    : file(std::tmpfile())
+                {
+                    if (!file)
+                        throw core::error("cppdatalib::core::external_sort_filter - unable to create temporary file");
+
+                    setvbuf(file, NULL, _IOFBF, buffer_size);
+                }
+                ~sort_run_file() {fclose(file);}
+
+                void write(const core::value &v)
+                {
+                    if (v.is_array() || v.is_object())
+                    {
+                        traverse_node_writer writer(*this);
+                        v.traverse(writer);
+                    }
+                    else
+                        put_node(v);
+                }
+
+                // Prepares the file for reading, after all values have been written
+                void rewind()
+                {
+                    if (fflush(file) != 0 || fseek(file, 0, SEEK_SET) != 0)
+                        throw core::error("cppdatalib::core::external_sort_filter - unable to write to temporary file");
+                }
+
+                // Reads the next value from the file into `v`. Returns false if no values remain
+                bool read(core::value &v)
+                {
+                    // Each entry holds the type of an unfinished container and the number of elements (or keys and values) left
+                    std::vector<std::pair<core::type, uint64_t>> containers;
+                    core::value_builder builder(v);
+                    int c = getc(file);
+
+                    if (c == EOF)
+                        return false;
+
+                    builder.begin();
+                    while (true)
+                    {
+                        if (c == EOF)
+                            throw core::error("cppdatalib::core::external_sort_filter - unexpected end of temporary file");
+
+                        const core::type type = static_cast<core::type>(c & 0x7f);
+                        core::subtype_t subtype = core::normal;
+
+                        if (c & 0x80)
+                        {
+                            char buffer[2];
+                            get(buffer, 2);
+                            subtype = static_cast<core::subtype_t>(static_cast<int16_t>((uint16_t(uint8_t(buffer[0])) << 8) | uint8_t(buffer[1])));
+                        }
+
+                        switch (type)
+                        {
+                            case core::null: builder.write(core::value(core::null_t(), subtype)); break;
+                            case core::boolean:
+                            {
+                                char b;
+                                get(&b, 1);
+                                builder.write(core::value(core::bool_t(b != 0), subtype));
+                                break;
+                            }
+                            case core::integer:
+                            {
+                                const uint64_t i = get_varint();
+                                builder.write(core::value(static_cast<core::int_t>((i >> 1) ^ (~(i & 1) + 1)), subtype));
+                                break;
+                            }
+                            case core::uinteger: builder.write(core::value(core::uint_t(get_varint()), subtype)); break;
+                            case core::real:
+                            {
+                                core::real_t r;
+                                get(reinterpret_cast<char *>(&r), sizeof(r));
+                                builder.write(core::value(r, subtype));
+                                break;
+                            }
+                            case core::string:
+                            {
+                                core::string_t s(static_cast<size_t>(get_varint()), '\0');
+                                if (!s.empty())
+                                    get(&s[0], s.size());
+                                builder.write(core::value(std::move(s), subtype));
+                                break;
+                            }
+                            case core::array:
+                            case core::object:
+                            {
+                                const uint64_t size = get_varint();
+
+                                if (size == 0)
+                                    builder.write(type == core::array? core::value(core::array_t(), subtype): core::value(core::object_t(), subtype));
+                                else
+                                {
+                                    if (type == core::array)
+                                        builder.begin_array(core::value(core::array_t(), subtype), size);
+                                    else
+                                        builder.begin_object(core::value(core::object_t(), subtype), size);
+
+                                    containers.push_back(std::make_pair(type, type == core::array? size: size * 2));
+                                    c = getc(file);
+                                    continue;
+                                }
+                                break;
+                            }
+                            default:
+                                throw core::error("cppdatalib::core::external_sort_filter - invalid type in temporary file");
+                        }
+
+                        // An element is complete, so close any containers that are now complete as well
+                        while (!containers.empty() && --containers.back().second == 0)
+                        {
+                            if (containers.back().first == core::array)
+                                builder.end_array(core::array_t());
+                            else
+                                builder.end_object(core::object_t());
+                            containers.pop_back();
+                        }
+
+                        if (containers.empty())
+                            break;
+
+                        c = getc(file);
+                    }
+                    builder.end();
+
+                    return true;
+                }
+            };
+
+            // Returns the approximate number of bytes of memory used by `v`
+            struct traverse_node_memory_size
+            {
+                size_t size;
+
+                traverse_node_memory_size() : size(0) {}
+
+                bool operator()(const core::value *arg, core::value::traversal_ancestry_finder, bool prefix)
+                {
+                    if (prefix)
+                        size += sizeof(core::value) + (arg->is_string()? arg->string_size(): 0);
+                    return true;
+                }
+            };
+
+            inline size_t memory_size(const core::value &v)
+            {
+                traverse_node_memory_size counter;
+                v.traverse(counter);
+                return counter.size;
+            }
+        }
+
+        // Sorts the elements of arrays deeper than the specified nesting level (or all arrays, if 0 is specified), like `array_sort_filter`,
+        // but with a bounded amount of memory
+        //
+        // Elements are collected into runs of approximately `memory_limit` bytes. Each run is sorted (in parallel on the threads of `executor`,
+        // if one is given) and, if the array does not fit in one run, written to a temporary file.
+        // The runs are then merged as the sorted elements are written to the output. Arrays inside the elements are not sorted
+        template<sort_filter_flag direction = ascending_sort>
+        class external_sort_filter : public impl::stream_filter_base
+        {
+        public:
+            // Maximum number of runs merged at once. Runs are merged into larger runs as they are written, so fewer than this
+            // many runs (plus one while merging) are kept in temporary files at once
+            static const size_t max_merge_width = 64;
+
+        private:
+            typedef typename std::conditional<direction == ascending_sort, std::less<core::value>, std::greater<core::value>>::type compare;
+
+            const size_t memory_limit;
+            const size_t nesting_level;
+            parallel_executor * const executor;
+
+            std::vector<core::value> run;
+            size_t run_size;
+            std::vector<std::unique_ptr<impl::sort_run_file>> runs;
+            std::vector<size_t> run_levels; // Number of times the values in each run have been merged
+
+            core::value element;
+            core::value_builder element_builder;
+
+            bool sorting; // True while the elements of an array are being sorted
+
+            void spill_run()
+            {
+                std::unique_ptr<impl::sort_run_file> file(new impl::sort_run_file());
+
+                impl::parallel_sort(run.begin(), run.end(), compare(), executor);
+                for (const auto &v: run)
+                    file->write(v);
+                file->rewind();
+
+                runs.push_back(std::move(file));
+                run_levels.push_back(0);
+                run.clear();
+                run_size = 0;
+
+                // Keep fewer than `max_merge_width` runs. Levels never increase towards the end of `runs`, so the newest runs have the lowest level.
+                // Those are merged into one run of the next level (along with the runs of the next level, if only one run has the lowest level),
+                // so each run is merged with runs of similar size, and each element is rewritten a logarithmic number of times
+                if (runs.size() >= max_merge_width)
+                {
+                    size_t first = runs.size() - 1;
+
+                    while (first > 0 && run_levels[first - 1] == run_levels.back())
+                        --first;
+
+                    if (first == runs.size() - 1)
+                        while (first > 0 && run_levels[first - 1] == run_levels[runs.size() - 2])
+                            --first;
+
+                    merge_into_run(first, runs.size());
+                }
+            }
+
+            // Replaces runs [first, last) with a single run containing their merged values
+            void merge_into_run(size_t first, size_t last)
+            {
+                std::unique_ptr<impl::sort_run_file> file(new impl::sort_run_file());
+                const size_t level = run_levels[first] + 1; // The highest level of the merged runs, plus one
+
+                merge_runs(first, last, [&file](const core::value &v) {file->write(v);});
+                file->rewind();
+
+                runs.erase(runs.begin() + first, runs.begin() + last);
+                run_levels.erase(run_levels.begin() + first, run_levels.begin() + last);
+                runs.insert(runs.begin() + first, std::move(file));
+                run_levels.insert(run_levels.begin() + first, level);
+            }
+
+            // Merges runs [first, last) and passes each value, in order, to `f`
+            template<typename F>
+            void merge_runs(size_t first, size_t last, F f)
+            {
+                std::vector<core::value> heads(last - first);
+                std::vector<size_t> heap;
+
+                // Heap of indexes into `heads`, with the next value to be output on top. Earlier runs win ties
+                auto later = [&heads](size_t a, size_t b) {return compare()(heads[b], heads[a]) || (!compare()(heads[a], heads[b]) && a > b);};
+
+                for (size_t i = 0; i < heads.size(); ++i)
+                    if (runs[first + i]->read(heads[i]))
+                        heap.push_back(i);
+                std::make_heap(heap.begin(), heap.end(), later);
+
+                while (!heap.empty())
+                {
+                    std::pop_heap(heap.begin(), heap.end(), later);
+
+                    const size_t i = heap.back();
+                    f(heads[i]);
+
+                    if (runs[first + i]->read(heads[i]))
+                        std::push_heap(heap.begin(), heap.end(), later);
+                    else
+                        heap.pop_back();
+                }
+            }
+
+            void add_element(core::value &&v)
+            {
+                run_size += impl::memory_size(v);
+                run.push_back(std::move(v));
+
+                if (run_size >= memory_limit)
+                    spill_run();
+            }
+
+            // Writes the sorted elements of the current array to the output
+            void finish_array()
+            {
+                if (runs.empty())
+                {
+                    impl::parallel_sort(run.begin(), run.end(), compare(), executor);
+                    for (const auto &v: run)
+                        output.write(v);
+                }
+                else
+                {
+                    if (!run.empty())
+                        spill_run();
+
+                    merge_runs(0, runs.size(), [this](const core::value &v) {output.write(v);});
+                }
+
+                run.clear();
+                run_size = 0;
+                runs.clear();
+                run_levels.clear();
+            }
+
+            void end_element()
+            {
+                if (element_builder.nesting_depth() == 0)
+                {
+                    element_builder.end();
+                    add_element(std::move(element));
+                }
+            }
+
+        public:
+            // `memory_limit` is the approximate number of bytes of elements kept in memory at once
+            external_sort_filter(core::stream_handler &output, size_t memory_limit = 64 * 1024 * 1024, size_t nesting_level = 0, parallel_executor *executor = NULL)
+                : stream_filter_base(output)
+                , memory_limit(memory_limit)
+                , nesting_level(nesting_level)
+                , executor(executor)
+                , run_size(0)
+                , element_builder(element)
+                , sorting(false)
+            {}
+
+        protected:
+            void begin_()
+            {
+                output.begin();
+                run.clear();
+                run_size = 0;
+                runs.clear();
+                run_levels.clear();
+                sorting = false;
+            }
+
+            bool write_(const value &v, bool is_key)
+            {
+                (void) is_key;
+
+                if (element_builder.active())
+                    element_builder.write(v);
+                else if (sorting)
+                    add_element(core::value(v));
+                else if (v.is_array() && nesting_level <= nesting_depth())
+                    return false; // Expand the array so its elements are sorted
+                else
+                    output.write(v);
+
+                return true;
+            }
+
+            void begin_array_(const value &v, int_t size, bool)
+            {
+                if (element_builder.active())
+                    element_builder.begin_array(v, size);
+                else if (sorting)
+                {
+                    element_builder.begin();
+                    element_builder.begin_array(v, size);
+                }
+                else if (nesting_level <= nesting_depth())
+                {
+                    sorting = true;
+                    output.begin_array(core::value(core::array_t(), v.get_subtype()), size);
+                }
+                else
+                    output.begin_array(v, size);
+            }
+            void end_array_(const value &v, bool)
+            {
+                if (element_builder.active())
+                {
+                    element_builder.end_array(v);
+                    end_element();
+                }
+                else if (sorting)
+                {
+                    finish_array();
+                    sorting = false;
+                    output.end_array(core::value(core::array_t(), v.get_subtype()));
+                }
+                else
+                    output.end_array(v);
+            }
+
+            void begin_object_(const value &v, int_t size, bool)
+            {
+                if (element_builder.active())
+                    element_builder.begin_object(v, size);
+                else if (sorting)
+                {
+                    element_builder.begin();
+                    element_builder.begin_object(v, size);
+                }
+                else
+                    output.begin_object(v, size);
+            }
+            void end_object_(const value &v, bool)
+            {
+                if (element_builder.active())
+                {
+                    element_builder.end_object(v);
+                    end_element();
+                }
+                else
+                    output.end_object(v);
+            }
+
+            void begin_string_(const value &v, int_t size, bool)
+            {
+                if (element_builder.active())
+                    element_builder.begin_string(v, size);
+                else if (sorting)
+                {
+                    element_builder.begin();
+                    element_builder.begin_string(v, size);
+                }
+                else
+                    output.begin_string(v, size);
+            }
+            void string_data_(const value &v, bool)
+            {
+                if (element_builder.active())
+                    element_builder.append_to_string(v);
+                else
+                    output.append_to_string(v);
+            }
+            void end_string_(const value &v, bool)
+            {
+                if (element_builder.active())
+                {
+                    element_builder.end_string(v);
+                    end_element();
+                }
+                else
+                    output.end_string(v);
+            }
+        };
+    }
+}
+
+#endif // CPPDATALIB_EXTERNAL_SORT_H
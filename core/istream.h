@@ -31,6 +31,7 @@
 #include <limits>
 #include <cstring>
 #include <memory>
+#include <algorithm>
 
 #include "error.h"
 
@@ -90,6 +91,15 @@ namespace cppdatalib
             virtual void ungetc_() = 0;
             virtual int peekc_() = 0;
 
+            // Skips up to `n` characters, returning the number skipped. Reimplement if the stream can skip faster than reading
+            virtual streamsize skip_(streamsize n)
+            {
+                streamsize skipped = 0;
+                while (skipped < n && getc_() != EOF)
+                    ++skipped;
+                return skipped;
+            }
+
         public:
             istream() : flags_(0), skip_ws(true)
 #ifndef CPPDATALIB_FAST_IO_DISABLE_GCOUNT
@@ -106,6 +116,8 @@ namespace cppdatalib
             bool fail() const {return rdstate() & (fail_bit | bad_bit);}
             bool bad() const {return rdstate() & bad_bit;}
 
+            void clear(iostate state = 0) {flags_ = state;}
+
 #ifndef CPPDATALIB_FAST_IO_DISABLE_GCOUNT
             streamsize gcount() const {return last_read_;}
 #endif
@@ -249,6 +261,31 @@ namespace cppdatalib
                 return *this;
             }
 
+            // Skips `n` characters. Unlike `std::istream::ignore()`, the failbit is set if the stream ends first
+            istream &ignore(streamsize n)
+            {
+#ifndef CPPDATALIB_FAST_IO_DISABLE_GCOUNT
+                last_read_ = 0;
+#endif
+
+                sentry s(*this);
+                if (!s)
+                {
+                    flags_ |= fail_bit;
+                    return *this;
+                }
+
+                const streamsize skipped = n > 0? skip_(n): 0;
+                if (skipped < n)
+                    flags_ = eof_bit | fail_bit;
+
+#ifndef CPPDATALIB_FAST_IO_DISABLE_GCOUNT
+                last_read_ = skipped;
+#endif
+
+                return *this;
+            }
+
             void unget()
             {
 #ifndef CPPDATALIB_FAST_IO_DISABLE_GCOUNT
@@ -578,6 +615,12 @@ namespace cppdatalib
                 else
                     flags_ |= bad_bit;
             }
+            streamsize skip_(streamsize n)
+            {
+                n = std::min(n, streamsize(string.size() - pos));
+                pos += static_cast<size_t>(n);
+                return n;
+            }
         };
 
         class istringstream : public istream
@@ -599,8 +642,8 @@ namespace cppdatalib
             void str(const std::string &s) {string = s; pos = 0;}
 
         protected:
-            int getc_() {return pos < string.size()? string[pos++]: EOF;}
-            int peekc_() {return pos < string.size()? string[pos]: EOF;}
+            int getc_() {return pos < string.size()? string[pos++] & 0xff: EOF;}
+            int peekc_() {return pos < string.size()? string[pos] & 0xff: EOF;}
             void ungetc_()
             {
                 if (pos > 0)
@@ -608,6 +651,12 @@ namespace cppdatalib
                 else
                     flags_ |= bad_bit;
             }
+            streamsize skip_(streamsize n)
+            {
+                n = std::min(n, streamsize(string.size() - pos));
+                pos += static_cast<size_t>(n);
+                return n;
+            }
         };
 
         class istd_streambuf_wrapper : public istream
@@ -642,11 +691,11 @@ namespace cppdatalib
             {
                 d_ = std::make_shared<istd_streambuf_wrapper>(stream.rdbuf());
             }
-            istream_handle(const char *string) : std_(NULL), d_(NULL)
+            istream_handle(const char *string) : std_(NULL), d_(NULL), predef_(NULL)
             {
                 d_ = std::make_shared<istringstream>(string);
             }
-            istream_handle(const char *string, size_t len) : std_(NULL), d_(NULL)
+            istream_handle(const char *string, size_t len) : std_(NULL), d_(NULL), predef_(NULL)
             {
                 d_ = std::make_shared<istringstream>(std::string(string, len));
             }
@@ -692,6 +741,26 @@ namespace cppdatalib
         };
 #endif
 
+        // Skips `n` bytes of `strm`, setting the failbit if the stream ends first
+        inline core::istream &skip_bytes(core::istream &strm, uint64_t n)
+        {
+#ifdef CPPDATALIB_ENABLE_FAST_IO
+            return strm.ignore(static_cast<core::istream::streamsize>(std::min(n, uint64_t(INT64_MAX))));
+#else
+            while (n > 0 && strm)
+            {
+                const std::streamsize chunk = static_cast<std::streamsize>(std::min(n, uint64_t(std::numeric_limits<std::streamsize>::max())));
+
+                strm.ignore(chunk);
+                if (strm.gcount() < chunk)
+                    strm.setstate(std::ios_base::failbit);
+                n -= static_cast<uint64_t>(chunk);
+            }
+
+            return strm;
+#endif
+        }
+
         template<typename T>
         core::istream &read_uint8(core::istream &strm, T &val)
         {
@@ -0,0 +1,339 @@
+/*
+ * parallel.h
+ *
+ * Copyright © 2017 Oliver Adams
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef CPPDATALIB_PARALLEL_H
+#define CPPDATALIB_PARALLEL_H
+
+#include "stream_filters.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+
+/*
+ * Concurrent access to values
+ *
+ * Any number of threads may read the same value concurrently, as long as no thread modifies it (or any value nested in it) at the same time.
+ * Reading includes the const member functions of `value`, `array_t` and `object_t` (type queries, get_*_unchecked(), size(), const iteration,
+ * member_ptr(), comparisons, hash()), the const traversal functions, and serializing the value to a separate stream_handler for each thread.
+ *
+ * The non-const accessors are writes, even when they look like reads: operator[], member(), get_*_ref() and the convert_to_*() functions
+ * may insert members or change the type of the value. Copying a value out of a shared value is a read, and the copy belongs to the copying thread.
+ */
+
+namespace cppdatalib
+{
+    namespace core
+    {
+        // A fixed set of worker threads that run the parts of one job at a time. The parts of a job are divided evenly between the
+        // workers and the calling thread, and a thread that runs out of parts steals half of the remaining parts of another thread.
+        // A pool can be given to the sorting filters as their `parallel_executor`
+        class thread_pool : public parallel_executor
+        {
+            struct range
+            {
+                std::mutex lock;
+                size_t begin, end; // Parts not yet taken by any thread
+            };
+
+            std::vector<std::thread> workers;
+            std::vector<std::unique_ptr<range>> ranges; // One for each worker, followed by one for the calling thread
+
+            std::mutex lock;
+            std::condition_variable wake, done;
+            std::function<void (size_t)> job;
+            size_t generation; // Incremented whenever a job starts
+            size_t working; // Number of workers that have not finished the current job
+            bool stopping;
+
+            std::atomic<bool> running; // True while a job is running, so nested jobs are run on the calling thread instead
+            std::atomic<bool> failed; // True if a part of the current job has thrown an exception
+            std::exception_ptr error;
+
+            // Takes the next part from range `self`, stealing from other ranges if it is empty. Returns false if no parts remain
+            bool take(size_t self, size_t &part)
+            {
+                {
+                    std::lock_guard<std::mutex> guard(ranges[self]->lock);
+                    if (ranges[self]->begin < ranges[self]->end)
+                        return part = ranges[self]->begin++, true;
+                }
+
+                for (size_t i = 1; i < ranges.size(); ++i)
+                {
+                    range &victim = *ranges[(self + i) % ranges.size()];
+                    size_t begin, end;
+
+                    {
+                        std::lock_guard<std::mutex> guard(victim.lock);
+                        if (victim.begin == victim.end)
+                            continue;
+
+                        end = victim.end;
+                        begin = victim.end = victim.begin + (victim.end - victim.begin) / 2;
+                    }
+
+                    std::lock_guard<std::mutex> guard(ranges[self]->lock);
+                    ranges[self]->begin = begin + 1;
+                    ranges[self]->end = end;
+                    return part = begin, true;
+                }
+
+                return false;
+            }
+
+            void participate(size_t self)
+            {
+                size_t part;
+
+                while (!failed && take(self, part))
+                {
+                    try {job(part);}
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        if (!failed.exchange(true))
+                            error = std::current_exception();
+                    }
+                }
+            }
+
+            void worker(size_t self)
+            {
+                size_t seen = 0;
+
+                while (true)
+                {
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        wake.wait(guard, [&]{return stopping || generation != seen;});
+                        if (stopping)
+                            return;
+                        seen = generation;
+                    }
+
+                    participate(self);
+
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (--working == 0)
+                        done.notify_one();
+                }
+            }
+
+        public:
+            // Creates a pool with `threads` threads in total, including the calling thread. If `threads` is 0, one thread per core is used
+            explicit thread_pool(unsigned int threads = 0)
+                : generation(0)
+                , working(0)
+                , stopping(false)
+                , running(false)
+                , failed(false)
+            {
+                if (threads == 0)
+                    threads = std::max(1u, std::thread::hardware_concurrency());
+
+                for (unsigned int i = 0; i < threads; ++i)
+                    ranges.push_back(std::unique_ptr<range>(new range()));
+                for (unsigned int i = 1; i < threads; ++i)
+                    workers.push_back(std::thread(&thread_pool::worker, this, size_t(i - 1)));
+            }
+            ~thread_pool()
+            {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    stopping = true;
+                }
+
+                wake.notify_all();
+                for (auto &w: workers)
+                    w.join();
+            }
+
+            thread_pool(const thread_pool &) = delete;
+            thread_pool &operator=(const thread_pool &) = delete;
+
+            // Returns the number of threads that run each job, including the calling thread
+            size_t size() const {return ranges.size();}
+
+            // Calls `f(part)` for every part in [0, parts), and returns when all calls have finished.
+            // If any call throws, the remaining parts are abandoned and the first exception is rethrown.
+            // If the pool is already running a job (for example, when run() is called from within `f`), the parts are run sequentially on the calling thread
+            void run(size_t parts, std::function<void (size_t)> f)
+            {
+                if (parts == 0)
+                    return;
+                else if (parts == 1 || workers.empty() || running.exchange(true))
+                {
+                    for (size_t i = 0; i < parts; ++i)
+                        f(i);
+                    return;
+                }
+
+                for (size_t i = 0; i < ranges.size(); ++i)
+                {
+                    ranges[i]->begin = parts * i / ranges.size();
+                    ranges[i]->end = parts * (i + 1) / ranges.size();
+                }
+
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    job = std::move(f);
+                    error = std::exception_ptr();
+                    failed = false;
+                    working = workers.size();
+                    ++generation;
+                }
+
+                wake.notify_all();
+                participate(ranges.size() - 1);
+
+                std::exception_ptr result;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    done.wait(guard, [&]{return working == 0;});
+                    job = nullptr;
+                    result = error;
+                }
+
+                running = false;
+                if (result)
+                    std::rethrow_exception(result);
+            }
+        };
+
+        namespace impl
+        {
+            // Returns the number of parts to split `size` elements into, so that parts can be balanced between the threads of `pool`
+            inline size_t parallel_part_count(size_t size, const thread_pool &pool)
+            {
+                const size_t min_part_size = 256;
+                return std::max(size_t(1), std::min(size / min_part_size, pool.size() * 8));
+            }
+
+            inline const array_t::container_type &parallel_array(const value &array)
+            {
+                if (!array.is_array())
+                    throw core::error("cppdatalib::core::parallel - value is not an array");
+                return array.get_array_unchecked().data();
+            }
+        }
+
+        // Returns the pool used by the parallel algorithms when no pool is given, with one thread per core
+        inline thread_pool &default_thread_pool()
+        {
+            static thread_pool pool;
+            return pool;
+        }
+
+        // Calls `f(element)` for every element of `array`, in parallel. `f` must be safe to call concurrently
+        template<typename F>
+        void parallel_for_each(const value &array, F f, thread_pool &pool = default_thread_pool())
+        {
+            const array_t::container_type &elements = impl::parallel_array(array);
+            const size_t parts = impl::parallel_part_count(elements.size(), pool);
+
+            pool.run(parts, [&](size_t part)
+            {
+                for (size_t i = elements.size() * part / parts; i < elements.size() * (part + 1) / parts; ++i)
+                    f(elements[i]);
+            });
+        }
+
+        // Calls `f(key, value)` for every member of `object`, in parallel. `f` must be safe to call concurrently
+        // Objects cannot be indexed, so the member nodes are walked once to split them into ranges
+        template<typename F>
+        void parallel_for_each_member(const value &object, F f, thread_pool &pool = default_thread_pool())
+        {
+            if (!object.is_object())
+                throw core::error("cppdatalib::core::parallel - value is not an object");
+
+            const object_t::container_type &members = object.get_object_unchecked().data();
+            const size_t parts = impl::parallel_part_count(members.size(), pool);
+            std::vector<object_t::container_type::const_iterator> bounds;
+
+            auto it = members.begin();
+            for (size_t i = 0, part = 0; part <= parts; ++it, ++i)
+            {
+                while (part <= parts && i == members.size() * part / parts)
+                    bounds.push_back(it), ++part;
+                if (it == members.end())
+                    break;
+            }
+
+            pool.run(parts, [&](size_t part)
+            {
+                for (auto it = bounds[part]; it != bounds[part + 1]; ++it)
+                    f(it->first, it->second);
+            });
+        }
+
+        // Returns an array containing `f(element)` for every element of `array`, in order, computed in parallel. `f` must be safe to call concurrently
+        template<typename F>
+        value parallel_transform(const value &array, F f, thread_pool &pool = default_thread_pool())
+        {
+            const array_t::container_type &elements = impl::parallel_array(array);
+            const size_t parts = impl::parallel_part_count(elements.size(), pool);
+            array_t::container_type result(elements.size());
+
+            pool.run(parts, [&](size_t part)
+            {
+                for (size_t i = elements.size() * part / parts; i < elements.size() * (part + 1) / parts; ++i)
+                    result[i] = f(elements[i]);
+            });
+
+            return value(array_t(std::move(result)), array.get_subtype());
+        }
+
+        // Returns `reduce(...reduce(reduce(identity, map(e0)), map(e1))..., map(eN))` over the elements of `array`, computed in parallel.
+        // `reduce` must be associative and `identity` must be its identity element, since contiguous runs of elements are reduced separately
+        // (starting from `identity`) and then combined in order. `map` and `reduce` must be safe to call concurrently
+        template<typename T, typename Map, typename Reduce>
+        T parallel_reduce(const value &array, T identity, Map map, Reduce reduce, thread_pool &pool = default_thread_pool())
+        {
+            const array_t::container_type &elements = impl::parallel_array(array);
+            const size_t parts = impl::parallel_part_count(elements.size(), pool);
+            std::vector<T> partial(parts, identity);
+
+            pool.run(parts, [&](size_t part)
+            {
+                T accumulator = identity;
+                for (size_t i = elements.size() * part / parts; i < elements.size() * (part + 1) / parts; ++i)
+                    accumulator = reduce(std::move(accumulator), map(elements[i]));
+                partial[part] = std::move(accumulator);
+            });
+
+            T result = std::move(identity);
+            for (auto &p: partial)
+                result = reduce(std::move(result), std::move(p));
+            return result;
+        }
+    }
+}
+
+#endif // CPPDATALIB_PARALLEL_H
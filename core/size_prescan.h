@@ -0,0 +1,207 @@
+/*
+ * size_prescan.h
+ *
+ * Copyright © 2017 Oliver Adams
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CPPDATALIB_SIZE_PRESCAN_H
+#define CPPDATALIB_SIZE_PRESCAN_H
+
+#include "stream_filters.h"
+#include <map>
+
+namespace cppdatalib
+{
+    namespace core
+    {
+        // Stores the sizes of every array, object, and string of a stream, in the order the containers were begun.
+        // Array sizes are element counts, object sizes are key/value pair counts, and string sizes are byte counts.
+        //
+        // Sizes are stored as 32-bit entries, with the rare larger sizes moved out of line,
+        // so the table takes roughly four bytes per container.
+        class size_table
+        {
+            static const uint32_t large_size_marker = 0xffffffffu;
+
+            std::vector<uint32_t> sizes;
+            std::map<size_t, uint64_t> large_sizes;
+
+        public:
+            void clear() {sizes.clear(); large_sizes.clear();}
+
+            // Returns the number of entries in the table
+            size_t size() const {return sizes.size();}
+
+            // Adds a new (zero) entry to the end of the table, and returns its index
+            size_t add_entry() {sizes.push_back(0); return sizes.size() - 1;}
+
+            void set_entry(size_t idx, uint64_t size)
+            {
+                if (size >= large_size_marker)
+                {
+                    sizes[idx] = large_size_marker;
+                    large_sizes[idx] = size;
+                }
+                else
+                {
+                    if (sizes[idx] == large_size_marker)
+                        large_sizes.erase(idx);
+                    sizes[idx] = uint32_t(size);
+                }
+            }
+
+            uint64_t entry(size_t idx) const
+            {
+                if (sizes[idx] == large_size_marker)
+                    return large_sizes.find(idx)->second;
+                return sizes[idx];
+            }
+        };
+
+        // Records the sizes of all arrays, objects, and strings of the input stream into a size_table.
+        // Nothing else is stored, so the memory used is proportional to the number of containers, not the size of the data.
+        class size_table_builder : public core::stream_handler
+        {
+            size_table &table;
+            std::vector<size_t> pending; // Table indexes of the containers currently being parsed
+
+        public:
+            size_table_builder(size_table &table) : table(table) {}
+
+        protected:
+            void begin_() {table.clear(); pending.clear();}
+
+            // Values written in one piece provide their own sizes, so they are not recorded
+            bool write_(const value &, bool) {return true;}
+
+            void begin_array_(const value &, int_t, bool) {pending.push_back(table.add_entry());}
+            void end_array_(const value &, bool) {table.set_entry(pending.back(), current_container_size()); pending.pop_back();}
+
+            void begin_object_(const value &, int_t, bool) {pending.push_back(table.add_entry());}
+            void end_object_(const value &, bool) {table.set_entry(pending.back(), current_container_size()); pending.pop_back();}
+
+            void begin_string_(const value &, int_t, bool) {pending.push_back(table.add_entry());}
+            void end_string_(const value &, bool) {table.set_entry(pending.back(), current_container_size()); pending.pop_back();}
+        };
+
+        // Provides the sizes recorded in a size_table to the output handler.
+        // The input stream must be identical to the stream the size table was built from.
+        // An error is thrown if the actual sizes differ from the recorded sizes.
+        class size_table_filter : public impl::stream_filter_base
+        {
+            const size_table &table;
+            size_t next_entry;
+            std::vector<uint64_t> expected; // Recorded sizes of the containers currently being parsed
+
+            uint64_t begin_container(int_t size)
+            {
+                if (next_entry >= table.size())
+                    throw core::error("cppdatalib::core::size_table_filter - input stream contains more containers than the size table");
+
+                uint64_t recorded = table.entry(next_entry++);
+                if (size != unknown_size && uint64_t(size) != recorded)
+                    throw core::error("cppdatalib::core::size_table_filter - input stream does not match the size table");
+
+                expected.push_back(recorded);
+                return recorded;
+            }
+
+            void end_container()
+            {
+                if (current_container_size() != expected.back())
+                    throw core::error("cppdatalib::core::size_table_filter - input stream does not match the size table");
+                expected.pop_back();
+            }
+
+        public:
+            size_table_filter(core::stream_handler &output, const size_table &table)
+                : stream_filter_base(output)
+                , table(table)
+                , next_entry(0)
+            {}
+
+            unsigned int required_features() const
+            {
+                return stream_filter_base::required_features() & ~(requires_prefix_array_size |
+                                                                   requires_prefix_object_size |
+                                                                   requires_prefix_string_size);
+            }
+
+        protected:
+            void begin_()
+            {
+                stream_filter_base::begin_();
+                next_entry = 0;
+                expected.clear();
+            }
+
+            bool write_array_of_(const int64_t *data, size_t size) {output.write_array_of(data, size); return true;}
+            bool write_array_of_(const uint64_t *data, size_t size) {output.write_array_of(data, size); return true;}
+            bool write_array_of_(const double *data, size_t size) {output.write_array_of(data, size); return true;}
+            bool write_array_of_(const float *data, size_t size) {output.write_array_of(data, size); return true;}
+
+            void begin_array_(const value &v, int_t size, bool) {output.begin_array(v, begin_container(size));}
+            void end_array_(const value &v, bool) {end_container(); output.end_array(v);}
+
+            void begin_object_(const value &v, int_t size, bool) {output.begin_object(v, begin_container(size));}
+            void end_object_(const value &v, bool) {end_container(); output.end_object(v);}
+
+            void begin_string_(const value &v, int_t size, bool) {output.begin_string(v, begin_container(size));}
+            void end_string_(const value &v, bool) {end_container(); output.end_string(v);}
+        };
+
+        // Converts one value from `input` to `output` in two passes. The first pass only records the size of every
+        // array, object, and string, and the second pass re-parses the input, providing the exact sizes to `output`.
+        // This allows size-prefixed formats (e.g. MessagePack) to be written without buffering, at the cost of parsing twice.
+        //
+        // The input stream must be seekable. When fast IO is enabled, the parser must have been created from a std::istream.
+        inline void convert_with_size_prescan(core::stream_parser &input, core::stream_handler &output)
+        {
+#ifdef CPPDATALIB_ENABLE_FAST_IO
+            std::istream *stream = input.std_stream();
+#else
+            std::istream *stream = &input.stream();
+#endif
+            if (stream == NULL)
+                throw core::error("cppdatalib::core::convert_with_size_prescan - input stream is not seekable");
+
+            const std::istream::pos_type start = stream->tellg();
+            if (start == std::istream::pos_type(-1))
+                throw core::error("cppdatalib::core::convert_with_size_prescan - input stream is not seekable");
+
+            // `input` keeps a pointer to its last output, and checks it when the output is replaced, so the builder must outlive both passes
+            size_table table;
+            size_table_builder builder(table);
+            input.convert(builder);
+
+            stream->clear();
+            stream->seekg(start);
+            if (!*stream)
+                throw core::error("cppdatalib::core::convert_with_size_prescan - unable to rewind input stream");
+            input.stream().clear();
+
+            size_table_filter filter(output, table);
+            filter << input;
+        }
+    }
+}
+
+#endif // CPPDATALIB_SIZE_PRESCAN_H
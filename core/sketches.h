@@ -0,0 +1,657 @@
+/*
+ * sketches.h
+ *
+ * Copyright © 2017 Oliver Adams
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef CPPDATALIB_SKETCHES_H
+#define CPPDATALIB_SKETCHES_H
+
+#include "value_builder.h"
+#include <unordered_map>
+
+namespace cppdatalib
+{
+    namespace core
+    {
+        // A mergeable streaming quantile estimator (a merging t-digest)
+        //
+        // Samples are clustered into weighted centroids, with small clusters near the tails and larger clusters near the median,
+        // so extreme quantiles (p99, p99.9) stay accurate. Memory use is bounded by the compression setting, not by the number of samples.
+        // Higher compression gives more accuracy at the cost of more centroids (roughly half of `compression` after merging)
+        //
+        // Samples are buffered and merged lazily, so quantile() and centroid_count() modify the sketch even though they are const.
+        // A sketch must not be read from several threads at once (not even with count() alongside them) without external locking;
+        // give each thread its own copy instead
+        class quantile_sketch
+        {
+            struct centroid
+            {
+                centroid() : mean(0), weight(0) {}
+                centroid(core::real_t mean, core::real_t weight) : mean(mean), weight(weight) {}
+
+                bool operator<(const centroid &other) const {return mean < other.mean;}
+
+                core::real_t mean;
+                core::real_t weight;
+            };
+
+            core::real_t compression_;
+            mutable std::vector<centroid> centroids; // Merged centroids, sorted by mean
+            mutable std::vector<centroid> unmerged; // Samples and centroids not yet merged
+            mutable core::real_t merged_weight, unmerged_weight;
+            size_t unmerged_limit;
+            core::real_t min_, max_;
+
+            // Scale function k1 of the t-digest paper. Adjacent centroids may be merged if the k-size of the result does not exceed 1
+            core::real_t scale(core::real_t q) const
+            {
+                q = std::min(std::max(q, core::real_t(0)), core::real_t(1));
+                return compression_ * std::asin(2 * q - 1) / (2 * 3.14159265358979323846);
+            }
+
+            void flush() const
+            {
+                if (unmerged.empty())
+                    return;
+
+                const core::real_t total = merged_weight + unmerged_weight;
+
+                unmerged.insert(unmerged.end(), centroids.begin(), centroids.end());
+                std::sort(unmerged.begin(), unmerged.end());
+                centroids.clear();
+
+                core::real_t weight_so_far = 0;
+                core::real_t k_lower = scale(0);
+                centroid current = unmerged.front();
+
+                for (size_t i = 1; i < unmerged.size(); ++i)
+                {
+                    const centroid &next = unmerged[i];
+
+                    if (scale((weight_so_far + current.weight + next.weight) / total) - k_lower <= 1)
+                    {
+                        current.weight += next.weight;
+                        current.mean += (next.mean - current.mean) * next.weight / current.weight;
+                    }
+                    else
+                    {
+                        weight_so_far += current.weight;
+                        k_lower = scale(weight_so_far / total);
+                        centroids.push_back(current);
+                        current = next;
+                    }
+                }
+                centroids.push_back(current);
+
+                merged_weight = total;
+                unmerged.clear();
+                unmerged_weight = 0;
+            }
+
+        public:
+            quantile_sketch(core::real_t compression = 100)
+                : compression_(compression)
+                , unmerged_limit(static_cast<size_t>(std::ceil(compression * 5)))
+            {
+                if (!(compression > 0))
+                    throw core::error("cppdatalib::core::quantile_sketch - compression must be positive");
+
+                clear();
+            }
+
+            void clear()
+            {
+                centroids.clear();
+                unmerged.clear();
+                merged_weight = unmerged_weight = 0;
+                min_ = INFINITY;
+                max_ = -INFINITY;
+            }
+
+            core::real_t compression() const {return compression_;}
+
+            // Adds `sample` with weight `weight`. NaN samples are ignored
+            void add(core::real_t sample, core::real_t weight = 1)
+            {
+                if (std::isnan(sample) || !(weight > 0))
+                    return;
+
+                unmerged.push_back(centroid(sample, weight));
+                unmerged_weight += weight;
+                min_ = std::min(min_, sample);
+                max_ = std::max(max_, sample);
+
+                if (unmerged.size() >= unmerged_limit)
+                    flush();
+            }
+
+            // Adds all samples summarized by `other` to this sketch
+            void merge(const quantile_sketch &other)
+            {
+                other.flush();
+
+                for (auto const &c: other.centroids)
+                {
+                    unmerged.push_back(c);
+                    unmerged_weight += c.weight;
+                }
+
+                min_ = std::min(min_, other.min_);
+                max_ = std::max(max_, other.max_);
+                flush();
+            }
+
+            // Returns the total weight of all samples (the number of samples, if all were added with weight 1)
+            core::real_t count() const {return merged_weight + unmerged_weight;}
+            bool empty() const {return count() == 0;}
+
+            core::real_t min() const {return empty()? NAN: min_;}
+            core::real_t max() const {return empty()? NAN: max_;}
+
+            size_t centroid_count() const {flush(); return centroids.size();}
+
+            // Returns the estimated value at quantile `q` (0 <= q <= 1), or NaN if there are no samples
+            core::real_t quantile(core::real_t q) const
+            {
+                flush();
+
+                if (centroids.empty() || std::isnan(q))
+                    return NAN;
+                else if (q <= 0)
+                    return min_;
+                else if (q >= 1)
+                    return max_;
+                else if (centroids.size() == 1)
+                    return centroids.front().mean;
+
+                const core::real_t index = q * merged_weight;
+
+                // Interpolate between the sample minimum and the center of the first centroid
+                const centroid &first = centroids.front();
+                if (index < first.weight / 2)
+                    return min_ + (first.mean - min_) * index / (first.weight / 2);
+
+                // Interpolate between centroid centers
+                core::real_t weight_so_far = first.weight / 2;
+                for (size_t i = 0; i + 1 < centroids.size(); ++i)
+                {
+                    const core::real_t gap = (centroids[i].weight + centroids[i+1].weight) / 2;
+
+                    if (weight_so_far + gap > index)
+                    {
+                        const core::real_t t = (index - weight_so_far) / gap;
+                        return centroids[i].mean + (centroids[i+1].mean - centroids[i].mean) * t;
+                    }
+
+                    weight_so_far += gap;
+                }
+
+                // Interpolate between the center of the last centroid and the sample maximum
+                const centroid &last = centroids.back();
+                return last.mean + (max_ - last.mean) * std::min(core::real_t(1), (index - weight_so_far) / (last.weight / 2));
+            }
+        };
+
+        // A bounded-memory estimator of the most frequent values in a stream (the Space-Saving algorithm)
+        //
+        // At most `capacity` values are tracked. When a new value arrives and all counters are in use, the value with the
+        // lowest count is replaced, and the new value inherits its count as the error bound. The count reported for a value
+        // overestimates its true frequency by at most its error, and every value with true frequency above
+        // `count() / capacity` is guaranteed to be tracked
+        class frequent_items_sketch
+        {
+        public:
+            struct item
+            {
+                item() : count(0), error(0) {}
+                item(const core::value &value, core::uint_t count, core::uint_t error) : value(value), count(count), error(error) {}
+
+                core::value value;
+                core::uint_t count; // Estimated frequency, never less than the true frequency
+                core::uint_t error; // Maximum overestimation of `count`; the true frequency is at least `count - error`
+            };
+
+        private:
+            size_t capacity_;
+            core::uint_t total;
+            std::vector<item> slots;
+            std::vector<size_t> heap; // Min-heap of slot indexes, ordered by count
+            std::vector<size_t> heap_position; // Position of each slot in `heap`
+            std::unordered_map<core::value, size_t> index; // Maps tracked values to slots
+
+            bool heap_less(size_t a, size_t b) const {return slots[heap[a]].count < slots[heap[b]].count;}
+
+            void heap_swap(size_t a, size_t b)
+            {
+                std::swap(heap[a], heap[b]);
+                heap_position[heap[a]] = a;
+                heap_position[heap[b]] = b;
+            }
+
+            void sift_up(size_t pos)
+            {
+                while (pos > 0 && heap_less(pos, (pos - 1) / 2))
+                {
+                    heap_swap(pos, (pos - 1) / 2);
+                    pos = (pos - 1) / 2;
+                }
+            }
+
+            void sift_down(size_t pos)
+            {
+                while (true)
+                {
+                    size_t smallest = pos;
+                    const size_t left = 2 * pos + 1, right = left + 1;
+
+                    if (left < heap.size() && heap_less(left, smallest))
+                        smallest = left;
+                    if (right < heap.size() && heap_less(right, smallest))
+                        smallest = right;
+
+                    if (smallest == pos)
+                        return;
+
+                    heap_swap(pos, smallest);
+                    pos = smallest;
+                }
+            }
+
+            void add(const core::value &v, core::uint_t weight, core::uint_t error)
+            {
+                auto it = index.find(v);
+
+                total += weight;
+                if (it != index.end())
+                {
+                    slots[it->second].count += weight;
+                    slots[it->second].error += error;
+                    sift_down(heap_position[it->second]);
+                }
+                else if (slots.size() < capacity_)
+                {
+                    index[v] = slots.size();
+                    heap_position.push_back(heap.size());
+                    heap.push_back(slots.size());
+                    slots.push_back(item(v, weight, error));
+                    sift_up(heap.size() - 1);
+                }
+                else // Replace the least frequent value
+                {
+                    const size_t slot = heap.front();
+                    item &replaced = slots[slot];
+
+                    index.erase(replaced.value);
+                    index[v] = slot;
+
+                    replaced.value = v;
+                    replaced.error = replaced.count + error;
+                    replaced.count += weight;
+                    sift_down(0);
+                }
+            }
+
+        public:
+            frequent_items_sketch(size_t capacity = 1024)
+                : capacity_(capacity)
+                , total(0)
+            {
+                if (capacity == 0)
+                    throw core::error("cppdatalib::core::frequent_items_sketch - capacity must be positive");
+            }
+
+            void clear()
+            {
+                total = 0;
+                slots.clear();
+                heap.clear();
+                heap_position.clear();
+                index.clear();
+            }
+
+            size_t capacity() const {return capacity_;}
+
+            // Returns the total weight of all values added
+            core::uint_t count() const {return total;}
+
+            // Returns the number of values currently tracked
+            size_t size() const {return slots.size();}
+
+            void add(const core::value &v, core::uint_t weight = 1) {add(v, weight, 0);}
+
+            // Adds the values summarized by `other` to this sketch. Afterwards, counts still never underestimate true frequencies, and every value
+            // with true frequency above `count() / capacity()` is still tracked (the mergeable Space-Saving summary of Agarwal et al.)
+            void merge(const frequent_items_sketch &other)
+            {
+                // A value tracked by only one sketch may have occurred up to the other sketch's minimum count times in the other stream
+                const core::uint_t min_count = slots.size() < capacity_? 0: slots[heap.front()].count;
+                const core::uint_t other_min_count = other.slots.size() < other.capacity_? 0: other.slots[other.heap.front()].count;
+                std::vector<item> merged;
+
+                for (auto const &i: slots)
+                {
+                    auto it = other.index.find(i.value);
+
+                    if (it != other.index.end())
+                        merged.push_back(item(i.value, i.count + other.slots[it->second].count, i.error + other.slots[it->second].error));
+                    else
+                        merged.push_back(item(i.value, i.count + other_min_count, i.error + other_min_count));
+                }
+
+                for (auto const &i: other.slots)
+                    if (index.find(i.value) == index.end())
+                        merged.push_back(item(i.value, i.count + min_count, i.error + min_count));
+
+                // Keep the `capacity` values with the highest counts
+                if (merged.size() > capacity_)
+                {
+                    std::nth_element(merged.begin(), merged.begin() + capacity_, merged.end(), [](const item &a, const item &b) {return a.count > b.count;});
+                    merged.resize(capacity_);
+                }
+
+                total += other.total;
+                slots = std::move(merged);
+                heap.clear();
+                heap_position.clear();
+                index.clear();
+                for (size_t i = 0; i < slots.size(); ++i)
+                {
+                    index[slots[i].value] = i;
+                    heap_position.push_back(i);
+                    heap.push_back(i);
+                }
+                for (size_t i = heap.size() / 2; i > 0; --i)
+                    sift_down(i - 1);
+            }
+
+            // Returns the estimated frequency of `v`, or 0 if `v` is not tracked
+            core::uint_t estimate(const core::value &v) const
+            {
+                auto it = index.find(v);
+                return it != index.end()? slots[it->second].count: 0;
+            }
+
+            // Returns up to `k` tracked values with the highest estimated frequencies, most frequent first
+            std::vector<item> top(size_t k) const
+            {
+                std::vector<item> result(slots);
+
+                k = std::min(k, result.size());
+                std::partial_sort(result.begin(), result.begin() + k, result.end(), [](const item &a, const item &b)
+                {
+                    return a.count > b.count || (a.count == b.count && a.error < b.error);
+                });
+                result.resize(k);
+
+                return result;
+            }
+        };
+
+        // A mergeable estimator of the number of distinct values in a stream (HyperLogLog, with 64-bit hashes)
+        //
+        // The sketch uses 2^`precision` one-byte registers, and the relative standard error of the estimate is about
+        // 1.04 / sqrt(2^`precision`) (1.6% at the default precision of 12, using 4 KiB).
+        // Estimates use Ertl's improved estimator, which is accurate from very small to very large cardinalities
+        // without empirical bias correction tables
+        class cardinality_sketch
+        {
+            int precision_;
+            std::vector<uint8_t> registers;
+
+            // Helper functions of the improved estimator
+            static core::real_t sigma(core::real_t x)
+            {
+                if (x == 1)
+                    return INFINITY;
+
+                core::real_t y = 1, z = x, z_old;
+                do
+                {
+                    x *= x;
+                    z_old = z;
+                    z += x * y;
+                    y += y;
+                } while (z != z_old);
+
+                return z;
+            }
+
+            static core::real_t tau(core::real_t x)
+            {
+                if (x == 0 || x == 1)
+                    return 0;
+
+                core::real_t y = 1, z = 1 - x, z_old;
+                do
+                {
+                    x = std::sqrt(x);
+                    z_old = z;
+                    y *= 0.5;
+                    z -= (1 - x) * (1 - x) * y;
+                } while (z != z_old);
+
+                return z / 3;
+            }
+
+        public:
+            cardinality_sketch(int precision = 12)
+                : precision_(precision)
+            {
+                if (precision < 4 || precision > 18)
+                    throw core::error("cppdatalib::core::cardinality_sketch - precision must be between 4 and 18");
+
+                registers.resize(size_t(1) << precision);
+            }
+
+            void clear() {std::fill(registers.begin(), registers.end(), 0);}
+
+            int precision() const {return precision_;}
+
+            // Adds a value, given its 64-bit hash
+            void add_hash(uint64_t hash)
+            {
+                const size_t idx = static_cast<size_t>(hash >> (64 - precision_));
+                uint8_t rank = 1;
+
+                // Rank is the position of the first set bit of the remaining hash bits
+                hash <<= precision_;
+                while (rank <= 64 - precision_ && !(hash >> 63))
+                {
+                    hash <<= 1;
+                    ++rank;
+                }
+
+                registers[idx] = std::max(registers[idx], rank);
+            }
+
+            void add(const core::value &v) {add_hash(v.hash());}
+
+            // Adds the values summarized by `other` to this sketch. Both sketches must have the same precision
+            void merge(const cardinality_sketch &other)
+            {
+                if (other.precision_ != precision_)
+                    throw core::error("cppdatalib::core::cardinality_sketch - cannot merge sketches with different precisions");
+
+                for (size_t i = 0; i < registers.size(); ++i)
+                    registers[i] = std::max(registers[i], other.registers[i]);
+            }
+
+            // Returns the estimated number of distinct values added
+            core::real_t estimate() const
+            {
+                const int q = 64 - precision_;
+                const core::real_t m = core::real_t(registers.size());
+                std::vector<size_t> histogram(q + 2);
+
+                for (auto reg: registers)
+                    ++histogram[reg];
+
+                core::real_t z = m * tau(1 - histogram[q + 1] / m);
+                for (int k = q; k >= 1; --k)
+                    z = 0.5 * (z + histogram[k]);
+                z += m * sigma(histogram[0] / m);
+
+                return m * m / (2 * std::log(2.0) * z);
+            }
+        };
+
+        // A floating-point sum with compensation for rounding error (the Kahan-Babuska-Neumaier algorithm)
+        class compensated_sum
+        {
+            core::real_t sum_, compensation;
+
+        public:
+            compensated_sum() : sum_(0), compensation(0) {}
+
+            void clear() {sum_ = compensation = 0;}
+
+            void add(core::real_t x)
+            {
+                const core::real_t t = sum_ + x;
+
+                if (std::fabs(sum_) >= std::fabs(x))
+                    compensation += (sum_ - t) + x;
+                else
+                    compensation += (x - t) + sum_;
+
+                sum_ = t;
+            }
+
+            void merge(const compensated_sum &other)
+            {
+                add(other.sum_);
+                add(other.compensation);
+            }
+
+            core::real_t value() const {return sum_ + compensation;}
+        };
+
+        // Accumulates summary statistics of a stream of numbers in constant memory
+        //
+        // The variance is computed with Welford's algorithm, and sums are compensated, so results stay accurate over long streams.
+        // Accumulators of separate streams (e.g. from other threads or files) can be merged with Chan's formulas, giving the same result
+        // as accumulating the concatenated streams. The geometric mean is computed from a sum of logarithms, so it does not overflow.
+        // Like the n-th root of the product, it is zero if any number is zero, negative for a single negative number, and NaN if the product of several numbers is negative
+        class statistics_accumulator
+        {
+            uint64_t count_;
+            uint64_t negative_count; // Number of negative numbers, which determines the sign of the product
+            bool zero; // True if a zero has been added, which makes the product zero
+            core::real_t mean_; // Running mean, used for the variance
+            core::real_t m2; // Sum of squared differences from the mean
+            core::real_t min_, max_;
+            compensated_sum sum_, log_sum, inverse_sum;
+
+        public:
+            statistics_accumulator() {clear();}
+
+            void clear()
+            {
+                count_ = negative_count = 0;
+                zero = false;
+                mean_ = m2 = 0;
+                min_ = INFINITY;
+                max_ = -INFINITY;
+                sum_.clear();
+                log_sum.clear();
+                inverse_sum.clear();
+            }
+
+            void add(core::real_t x)
+            {
+                const core::real_t delta = x - mean_;
+
+                ++count_;
+                mean_ += delta / count_;
+                m2 += delta * (x - mean_);
+
+                min_ = std::min(min_, x);
+                max_ = std::max(max_, x);
+                sum_.add(x);
+                if (x == 0)
+                    zero = true;
+                else
+                    log_sum.add(std::log(std::abs(x)));
+                negative_count += x < 0;
+                inverse_sum.add(1 / x);
+            }
+
+            // Adds the numbers summarized by `other` to this accumulator
+            void merge(const statistics_accumulator &other)
+            {
+                if (other.count_ == 0)
+                    return;
+                else if (count_ == 0)
+                {
+                    *this = other;
+                    return;
+                }
+
+                const core::real_t n = core::real_t(count_) + other.count_;
+                const core::real_t delta = other.mean_ - mean_;
+
+                m2 += other.m2 + delta * delta * (core::real_t(count_) * other.count_ / n);
+                mean_ += delta * (other.count_ / n);
+                count_ += other.count_;
+                negative_count += other.negative_count;
+                zero |= other.zero;
+
+                min_ = std::min(min_, other.min_);
+                max_ = std::max(max_, other.max_);
+                sum_.merge(other.sum_);
+                log_sum.merge(other.log_sum);
+                inverse_sum.merge(other.inverse_sum);
+            }
+
+            uint64_t count() const {return count_;}
+            bool empty() const {return count_ == 0;}
+
+            // The following functions return NaN if no numbers have been added
+            core::real_t sum() const {return count_? sum_.value(): NAN;}
+            core::real_t min() const {return count_? min_: NAN;}
+            core::real_t max() const {return count_? max_: NAN;}
+
+            core::real_t arithmetic_mean() const {return count_? sum_.value() / count_: NAN;}
+            core::real_t geometric_mean() const
+            {
+                if (count_ == 0)
+                    return NAN;
+
+                const core::real_t magnitude = zero? 0: std::exp(log_sum.value() / count_);
+
+                if (negative_count % 2 == 0 || zero)
+                    return magnitude;
+                return count_ == 1? -magnitude: NAN;
+            }
+            core::real_t harmonic_mean() const {return count_? count_ / inverse_sum.value(): NAN;}
+
+            // Population variance
+            core::real_t variance() const {return count_? m2 / count_: NAN;}
+            // Sample variance (with Bessel's correction), or NaN if fewer than two numbers have been added
+            core::real_t sample_variance() const {return count_ > 1? m2 / (count_ - 1): NAN;}
+            core::real_t standard_deviation() const {return std::sqrt(variance());}
+        };
+    }
+}
+
+#endif // CPPDATALIB_SKETCHES_H
@@ -57,6 +57,40 @@ namespace cppdatalib
             std::ostream *std_stream() {return handle.std_stream();}
         };
 
+        namespace impl
+        {
+            // Stores the encoded sizes of every container within a buffered value, in prefix order,
+            // so writers that need size prefixes for nested containers only have to compute them once.
+            //
+            // Sizes are added by a single post-order pass over the outermost container. When the value is then written,
+            // each nested container is matched with the next stored entry (by address) as the writer reaches it.
+            class encoded_size_cache
+            {
+                std::vector<std::pair<const core::value *, uint64_t>> sizes;
+                size_t next;
+
+            public:
+                encoded_size_cache() : next(0) {}
+
+                void clear() {sizes.clear(); next = 0;}
+
+                // Adds an entry for `v`, with size 0, and returns the index of the new entry
+                size_t add(const core::value &v) {sizes.push_back(std::make_pair(&v, uint64_t(0))); return sizes.size() - 1;}
+                uint64_t &size_at(size_t idx) {return sizes[idx].second;}
+
+                // Returns true if `v` is the next container expected, and stores its size in `size`
+                bool take(const core::value &v, uint64_t &size)
+                {
+                    if (next < sizes.size() && sizes[next].first == &v)
+                    {
+                        size = sizes[next++].second;
+                        return true;
+                    }
+                    return false;
+                }
+            };
+        }
+
         class stream_handler
         {
         protected:
@@ -166,6 +200,10 @@ namespace cppdatalib
             // Returns true if this is an object and a value of a key/value pair is expected
             bool container_key_was_just_parsed() const {return nested_scopes.back().key_was_parsed();}
 
+            // Returns true if the handler discards the contents of the innermost open array, object, or string.
+            // A parser may then skip the rest of its encoded contents without decoding them, but must still call the matching end_xxx() function
+            bool skip_requested() const {return nesting_depth() > 0 && skip_requested_();}
+
             // An API must call this when a scalar value is encountered,
             // although it should operate correctly for any value.
             // Returns true if value was handled, false otherwise
@@ -180,7 +218,11 @@ namespace cppdatalib
                 if (!write_(v, is_key))
                 {
                     if ((v.is_array() || v.is_object()) && v.size() > 0)
+                    {
+                        // The container's own begin and end events update the enclosing scope
                         *this << v;
+                        return true;
+                    }
                     else
                     {
                         if (is_key)
@@ -238,7 +280,51 @@ namespace cppdatalib
                 return true;
             }
 
+            // An API may call this when a run of numeric elements of the same type is parsed, directly inside an array.
+            // Supported element types are int64_t, uint64_t, double, and float.
+            // The result is identical to calling `write()` on each element in order, but handlers that implement
+            // `write_array_of_()` can process all the elements at once
+            template<typename T>
+            void write_array_of(const T *data, size_t size)
+            {
+                static_assert(std::is_same<T, int64_t>::value ||
+                              std::is_same<T, uint64_t>::value ||
+                              std::is_same<T, double>::value ||
+                              std::is_same<T, float>::value, "cppdatalib::core::stream_handler::write_array_of() - unsupported element type");
+
+                assert("cppdatalib::core::stream_handler - begin() must be called before handler can be used" && active());
+
+#ifndef CPPDATALIB_DISABLE_WRITE_CHECKS
+                if (nested_scopes.back().get_type() != array)
+                    throw error("cppdatalib::core::stream_handler - attempted to write array elements outside of an array");
+#endif
+
+                if (write_array_of_(data, size))
+                    nested_scopes.back().items_ += size;
+                else
+                    for (size_t i = 0; i < size; ++i)
+                        write(array_element(data[i]));
+            }
+
+        private:
+            static core::value array_element(int64_t v) {return core::int_t(v);}
+            static core::value array_element(uint64_t v) {return core::uint_t(v);}
+            static core::value array_element(double v) {return core::real_t(v);}
+            static core::value array_element(float v) {return core::real_t(v);}
+
         protected:
+            // Reimplement to return true if the contents of the innermost open container or string will be discarded
+            virtual bool skip_requested_() const {return false;}
+
+            // Called when write_array_of() is called, with the elements to write
+            // Return value from external routine:
+            //     true: all elements were written, cancel write routine
+            //     false: elements were not written, each element will be written separately with write()
+            virtual bool write_array_of_(const int64_t *data, size_t size) {(void) data; (void) size; return false;}
+            virtual bool write_array_of_(const uint64_t *data, size_t size) {(void) data; (void) size; return false;}
+            virtual bool write_array_of_(const double *data, size_t size) {(void) data; (void) size; return false;}
+            virtual bool write_array_of_(const float *data, size_t size) {(void) data; (void) size; return false;}
+
             // Called when write() is written
             // Return value from external routine:
             //     true: item was written, cancel write routine
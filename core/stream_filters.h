@@ -26,9 +26,12 @@
 #define CPPDATALIB_STREAM_FILTERS_H
 
 #include "value_builder.h"
-#include <set> // For duplicate_key_check_filter
+#include "sketches.h"
+#include <unordered_set> // For duplicate_key_check_filter
+#include <map> // For path automata
 #include <algorithm> // For sorting and specialty filters
 #include <functional> // For sorting
+#include <random> // For sampling_filter
 
 #include <cassert>
 
@@ -36,6 +39,21 @@ namespace cppdatalib
 {
     namespace core
     {
+        // Runs the parts of a job, possibly concurrently. Filters that can split their work (such as the sorting filters) accept an
+        // optional executor, and do all of the work on the calling thread without one. `thread_pool`, in parallel.h, implements this interface
+        class parallel_executor
+        {
+        public:
+            virtual ~parallel_executor() {}
+
+            // Returns the number of threads that run each job
+            virtual size_t size() const = 0;
+
+            // Calls `f(part)` for every part in [0, parts), and returns when all calls have finished.
+            // If any call throws, the first exception is rethrown
+            virtual void run(size_t parts, std::function<void (size_t)> f) = 0;
+        };
+
         namespace impl
         {
             class stream_filter_base : public stream_handler
@@ -103,6 +121,273 @@ namespace cppdatalib
                 }
             };
 
+            // Splits [0, size) into parts of at least `min_part_size` elements, up to one for each thread of `executor` (or one part if `executor` is NULL),
+            // and calls `f(begin, end)` for each part, in parallel. Returns the boundaries of the parts
+            template<typename F>
+            std::vector<size_t> parallel_parts(size_t size, parallel_executor *executor, size_t min_part_size, F f)
+            {
+                const size_t threads = executor? executor->size(): 1;
+                const size_t parts = std::max(size_t(1), std::min(threads, size / std::max(min_part_size, size_t(1))));
+                std::vector<size_t> bounds;
+
+                for (size_t i = 0; i <= parts; ++i)
+                    bounds.push_back(size * i / parts);
+
+                if (parts == 1)
+                    f(bounds[0], bounds[1]);
+                else
+                    executor->run(parts, [&bounds, &f](size_t part) {f(bounds[part], bounds[part+1]);});
+
+                return bounds;
+            }
+
+            // Sorts [first, last) with `comp`, using the threads of `executor` (if not NULL) for large ranges
+            template<typename RandomIt, typename Compare>
+            void parallel_sort(RandomIt first, RandomIt last, Compare comp, parallel_executor *executor)
+            {
+                const std::vector<size_t> bounds = parallel_parts(last - first, executor, 4096, [first, comp](size_t begin, size_t end)
+                {
+                    std::sort(first + begin, first + end, comp);
+                });
+                const size_t parts = bounds.size() - 1;
+
+                // Merge the sorted parts pairwise until one remains
+                for (size_t width = 1; width < parts; width *= 2)
+                    for (size_t i = 0; i + width < parts; i += width * 2)
+                        std::inplace_merge(first + bounds[i], first + bounds[i + width], first + bounds[std::min(i + width * 2, parts)], comp);
+            }
+
+            // A JSON pointer (e.g. "/users/0/id"), split into reference tokens, for filters that operate on part of each value
+            struct pointer_path
+            {
+                std::vector<core::value> tokens; // Unescaped reference tokens, as string values
+                std::vector<size_t> indexes; // Array index of each token, or -1 if the token is not a valid array index
+
+                // Parses `path`, returning false if it is not a valid JSON pointer
+                bool parse(const std::string &path)
+                {
+                    tokens.clear();
+                    indexes.clear();
+
+                    if (path.empty())
+                        return true;
+                    else if (path[0] != '/')
+                        return false;
+
+                    for (size_t start = 1, end; start <= path.size(); start = end + 1)
+                    {
+                        core::string_t token;
+
+                        end = std::min(path.find('/', start), path.size());
+                        for (size_t i = start; i < end; ++i)
+                        {
+                            if (path[i] != '~')
+                                token.push_back(path[i]);
+                            else if (i + 1 < end && (path[i+1] == '0' || path[i+1] == '1'))
+                                token.push_back(path[++i] == '0'? '~': '/');
+                            else
+                                return false;
+                        }
+
+                        // Indexes too large to represent are not valid array indexes
+                        size_t index = token.empty() || (token.size() > 1 && token[0] == '0')? size_t(-1): 0;
+                        for (size_t i = 0; i < token.size() && index != size_t(-1); ++i)
+                        {
+                            const size_t digit = token[i] - '0';
+
+                            if (!isdigit(static_cast<unsigned char>(token[i])) || index > (SIZE_MAX - 1 - digit) / 10)
+                                index = size_t(-1);
+                            else
+                                index = index * 10 + digit;
+                        }
+
+                        tokens.push_back(core::value(std::move(token)));
+                        indexes.push_back(index);
+                    }
+
+                    return true;
+                }
+
+                size_t size() const {return tokens.size();}
+                bool empty() const {return tokens.empty();}
+
+                // Returns true if the key `key` matches token `idx`
+                bool key_matches(size_t idx, const core::value &key) const
+                {
+                    return key.is_string() && key.get_string_unchecked() == tokens[idx].get_string_unchecked();
+                }
+
+                // Returns the value referred to by this path, relative to `root`, or NULL if it does not exist
+                const core::value *evaluate(const core::value &root) const
+                {
+                    const core::value *p = &root;
+
+                    for (size_t i = 0; i < tokens.size() && p; ++i)
+                    {
+                        if (p->is_object())
+                            p = p->member_ptr(tokens[i]);
+                        else if (p->is_array() && indexes[i] < p->array_size())
+                            p = &p->get_array_unchecked().data()[indexes[i]];
+                        else
+                            return NULL;
+                    }
+
+                    return p;
+                }
+            };
+
+            // A deterministic automaton that matches the location of each value in a stream against a set of JSON pointers, in constant time per value.
+            // The reference token "*" matches any array element, and, as in an ordinary JSON pointer, the object member named "*"
+            class pointer_automaton
+            {
+                struct state
+                {
+                    state() : any_index(-1), accepting(false) {}
+
+                    std::unordered_map<core::string_t, int> keys; // Transitions for object keys
+                    std::unordered_map<size_t, int> indexes; // Transitions for specific array indexes
+                    int any_index; // Transition for all other array indexes
+                    bool accepting; // True if a value in this state matches one of the pointers
+                };
+
+                std::vector<state> states;
+
+            public:
+                // Returned by transitions when no pointer can match the value or anything inside it
+                static const int dead = -1;
+
+                // Compiles the automaton for `paths`. Returns false if any path is not a valid JSON pointer
+                bool compile(const std::vector<std::string> &paths)
+                {
+                    struct trie_node
+                    {
+                        trie_node() : wildcard(size_t(-1)), accepting(false) {}
+
+                        std::map<core::string_t, size_t> children;
+                        std::map<size_t, size_t> indexes; // Children whose tokens are valid array indexes
+                        size_t wildcard;
+                        bool accepting;
+                    };
+
+                    std::vector<trie_node> trie(1);
+
+                    states.clear();
+                    for (const auto &path: paths)
+                    {
+                        pointer_path parsed;
+                        size_t node = 0;
+
+                        if (!parsed.parse(path))
+                            return false;
+
+                        for (size_t i = 0; i < parsed.size(); ++i)
+                        {
+                            const core::string_t &name = parsed.tokens[i].get_string_unchecked();
+                            const size_t parent = node;
+                            size_t &child = trie[node].children.insert(std::make_pair(name, size_t(-1))).first->second;
+
+                            if (child == size_t(-1))
+                            {
+                                child = trie.size(); // Assign before the reference is invalidated
+                                trie.push_back(trie_node());
+                            }
+                            node = child;
+
+                            // "*" matches array elements at any index, and also the literal key "*" through the child added above
+                            if (name == "*")
+                                trie[parent].wildcard = node;
+
+                            if (parsed.indexes[i] != size_t(-1))
+                                trie[parent].indexes[parsed.indexes[i]] = node;
+                        }
+
+                        trie[node].accepting = true;
+                    }
+
+                    // Subset construction, where each state is the set of trie nodes that match the current location
+                    std::map<std::vector<size_t>, int> ids;
+                    std::vector<std::vector<size_t>> pending(1, std::vector<size_t>(1, 0));
+
+                    auto id_of = [&](std::vector<size_t> &&set) -> int
+                    {
+                        if (set.empty())
+                            return dead;
+
+                        std::sort(set.begin(), set.end());
+                        set.erase(std::unique(set.begin(), set.end()), set.end());
+
+                        auto it = ids.find(set);
+                        if (it != ids.end())
+                            return it->second;
+
+                        const int id = static_cast<int>(ids.size());
+                        ids.insert(std::make_pair(set, id));
+                        pending.push_back(std::move(set));
+                        return id;
+                    };
+
+                    ids.insert(std::make_pair(pending[0], 0));
+                    for (size_t i = 0; i < pending.size(); ++i)
+                    {
+                        const std::vector<size_t> set = pending[i];
+                        std::map<core::string_t, std::vector<size_t>> keys;
+                        std::map<size_t, std::vector<size_t>> indexes;
+                        std::vector<size_t> wildcards;
+                        state result;
+
+                        for (size_t node: set)
+                        {
+                            result.accepting |= trie[node].accepting;
+                            if (trie[node].wildcard != size_t(-1))
+                                wildcards.push_back(trie[node].wildcard);
+
+                            for (const auto &child: trie[node].children)
+                                keys[child.first].push_back(child.second);
+                            for (const auto &child: trie[node].indexes)
+                                indexes[child.first].push_back(child.second);
+                        }
+
+                        for (auto &key: keys)
+                            result.keys[key.first] = id_of(std::move(key.second));
+                        for (auto &index: indexes)
+                        {
+                            index.second.insert(index.second.end(), wildcards.begin(), wildcards.end());
+                            result.indexes[index.first] = id_of(std::move(index.second));
+                        }
+                        result.any_index = id_of(std::move(wildcards));
+
+                        states.push_back(std::move(result));
+                    }
+
+                    return true;
+                }
+
+                // The state of top-level values
+                int start() const {return states.empty()? dead: 0;}
+
+                bool accepting(int s) const {return s != dead && states[s].accepting;}
+
+                // Returns the state of the element at `index` of an array in state `s`
+                int index_transition(int s, size_t index) const
+                {
+                    if (s == dead)
+                        return dead;
+
+                    auto it = states[s].indexes.find(index);
+                    return it != states[s].indexes.end()? it->second: states[s].any_index;
+                }
+
+                // Returns the state of the member with key `key` of an object in state `s`
+                int key_transition(int s, const core::string_t &key) const
+                {
+                    if (s == dead)
+                        return dead;
+
+                    auto it = states[s].keys.find(key);
+                    return it != states[s].keys.end()? it->second: dead;
+                }
+            };
+
             template<core::type from, core::type to>
             struct stream_filter_converter
             {
@@ -317,6 +602,8 @@ namespace cppdatalib
                 output.end();
             }
 
+            bool skip_requested_() const {return ignore_nesting > 0;}
+
             bool write_(const value &v, bool is_key)
             {
                 (void) is_key;
@@ -337,7 +624,10 @@ namespace cppdatalib
                     if (size != unknown_size && size_t(size) == v.size())
                     {
                         ++ignore_nesting;
-                        write_buffered_value_(v, is_key);
+                        if (cache.active()) // Part of a larger buffered value
+                            cache.write(v);
+                        else
+                            write_buffered_value_(v, is_key);
                         return;
                     }
 
@@ -377,7 +667,10 @@ namespace cppdatalib
                     if (size != unknown_size && size_t(size) == v.size())
                     {
                         ++ignore_nesting;
-                        write_buffered_value_(v, is_key);
+                        if (cache.active()) // Part of a larger buffered value
+                            cache.write(v);
+                        else
+                            write_buffered_value_(v, is_key);
                         return;
                     }
 
@@ -417,7 +710,10 @@ namespace cppdatalib
                     if (size != unknown_size && size_t(size) == v.size())
                     {
                         ++ignore_nesting;
-                        write_buffered_value_(v, is_key);
+                        if (cache.active()) // Part of a larger buffered value
+                            cache.write(v);
+                        else
+                            write_buffered_value_(v, is_key);
                         return;
                     }
 
@@ -487,6 +783,11 @@ namespace cppdatalib
             void begin_() {stream_filter_base::begin_(); output2.begin();}
             void end_() {stream_filter_base::end_(); output2.end();}
 
+            bool write_array_of_(const int64_t *data, size_t size) {output.write_array_of(data, size); output2.write_array_of(data, size); return true;}
+            bool write_array_of_(const uint64_t *data, size_t size) {output.write_array_of(data, size); output2.write_array_of(data, size); return true;}
+            bool write_array_of_(const double *data, size_t size) {output.write_array_of(data, size); output2.write_array_of(data, size); return true;}
+            bool write_array_of_(const float *data, size_t size) {output.write_array_of(data, size); output2.write_array_of(data, size); return true;}
+
             bool write_(const value &v, bool is_key)
             {
                 (void) is_key;
@@ -622,48 +923,174 @@ namespace cppdatalib
             harmonic_mean
         };
 
+        // Computes statistics of the values of the specified type
+        //
+        // In addition, statistics can be computed for several fields (or "columns") at once, by specifying JSON pointers to them, relative to
+        // each record. Records are values at `record_depth` (with 0 being top-level values, such as in an NDJSON stream, and 1 being the elements of a top-level array).
+        // All numeric values (of any type) at a field are included in that field's statistics.
+        //
+        // Statistics from separate streams (e.g. other threads or files) can be combined exactly with `merge()`
         template<core::type measure = core::real>
         class mean_filter : public impl::stream_filter_base
         {
-            size_t samples;
-            core::real_t sum, product, inverted_sum;
+        protected:
+            core::statistics_accumulator stats;
+
+        private:
+            std::vector<std::string> path_names;
+            std::vector<impl::pointer_path> paths;
+            std::vector<core::statistics_accumulator> path_stats;
+            size_t record_depth;
+
+            // Indexes of the paths that match each open container of the current record, stacked
+            std::vector<size_t> candidates;
+            std::vector<size_t> candidate_starts;
+
+            core::string_t key;
+            bool key_valid;
+
+            // Returns true if path `p` matches the location of the next value in the current container, at reference token `token`
+            bool location_matches(size_t p, size_t token) const
+            {
+                if (current_container() == core::array)
+                    return paths[p].indexes[token] == current_container_size();
+                return key_valid && paths[p].tokens[token].get_string_unchecked() == key;
+            }
+
+            // Calls `f` with the index of each path that matches the location of the next value, and has more than `min_size` reference tokens
+            template<typename F>
+            void for_each_matching_path(size_t min_size, F f)
+            {
+                const size_t depth = nesting_depth() - record_depth;
+
+                if (depth == 0)
+                {
+                    for (size_t p = 0; p < paths.size(); ++p)
+                        if (paths[p].size() >= min_size)
+                            f(p);
+                }
+                else
+                {
+                    for (size_t i = candidate_starts.back(), end = candidates.size(); i < end; ++i)
+                        if (paths[candidates[i]].size() >= min_size && location_matches(candidates[i], depth - 1))
+                            f(candidates[i]);
+                }
+            }
+
+            void measure_paths(const value &v)
+            {
+                if (paths.empty() || nesting_depth() < record_depth || !(v.is_int() || v.is_uint() || v.is_real()))
+                    return;
+
+                const size_t depth = nesting_depth() - record_depth;
+                const core::real_t value = v.as_real();
+
+                for_each_matching_path(depth, [&](size_t p) {if (paths[p].size() == depth) path_stats[p].add(value);});
+            }
+
+            void begin_container(bool is_key)
+            {
+                if (paths.empty() || nesting_depth() < record_depth)
+                    return;
+
+                const size_t start = candidates.size();
+
+                if (!is_key)
+                    for_each_matching_path(nesting_depth() - record_depth + 1, [&](size_t p) {candidates.push_back(p);});
+
+                candidate_starts.push_back(start);
+                key_valid = false;
+            }
+
+            void end_container()
+            {
+                if (paths.empty() || nesting_depth() <= record_depth)
+                    return;
+
+                candidates.resize(candidate_starts.back());
+                candidate_starts.pop_back();
+                key_valid = false;
+            }
 
         public:
             mean_filter(core::stream_handler &output)
                 : stream_filter_base(output)
-                , samples(0)
-                , sum(0)
-                , product(0)
-                , inverted_sum(0)
+                , record_depth(0)
+                , key_valid(false)
             {}
-
-            core::real_t get_mean(mean_filter_flag mean_type) const
+            mean_filter(core::stream_handler &output, const std::vector<std::string> &paths, size_t record_depth = 0)
+                : stream_filter_base(output)
+                , path_names(paths)
+                , path_stats(paths.size())
+                , record_depth(record_depth)
+                , key_valid(false)
             {
-                switch (mean_type)
+                for (const auto &path: paths)
                 {
-                    case arithmetic_mean: return sum / samples;
-                    case geometric_mean: return pow(product, 1.0 / samples);
-                    case harmonic_mean: return samples / inverted_sum;
-                    default: return NAN;
+                    this->paths.push_back(impl::pointer_path());
+                    if (!this->paths.back().parse(path))
+                        throw core::error("cppdatalib::core::mean_filter - invalid path");
                 }
             }
 
+            core::real_t get_mean(mean_filter_flag mean_type) const {return get_mean(stats, mean_type);}
+
             core::real_t get_arithmetic_mean() const {return get_mean(arithmetic_mean);}
             core::real_t get_geometric_mean() const {return get_mean(geometric_mean);}
             core::real_t get_harmonic_mean() const {return get_mean(harmonic_mean);}
 
             size_t sample_size() const
             {
-                return samples;
+                return static_cast<size_t>(stats.count());
+            }
+
+            // Returns the statistics of all values of the measured type
+            const core::statistics_accumulator &get_statistics() const {return stats;}
+
+            // Returns the statistics of the values at `path`, which must be one of the paths specified in the constructor
+            const core::statistics_accumulator &get_statistics(const std::string &path) const
+            {
+                for (size_t i = 0; i < path_names.size(); ++i)
+                    if (path_names[i] == path)
+                        return path_stats[i];
+
+                throw core::error("cppdatalib::core::mean_filter - statistics requested for unknown path");
+            }
+
+            core::real_t get_mean(const std::string &path, mean_filter_flag mean_type) const {return get_mean(get_statistics(path), mean_type);}
+
+            // Adds the statistics of `other` to this filter's statistics. If paths were specified, both filters must have the same paths
+            void merge(const mean_filter &other)
+            {
+                if (other.path_names != path_names)
+                    throw core::error("cppdatalib::core::mean_filter - cannot merge filters with different paths");
+
+                stats.merge(other.stats);
+                for (size_t i = 0; i < path_stats.size(); ++i)
+                    path_stats[i].merge(other.path_stats[i]);
             }
 
         protected:
+            static core::real_t get_mean(const core::statistics_accumulator &stats, mean_filter_flag mean_type)
+            {
+                switch (mean_type)
+                {
+                    case arithmetic_mean: return stats.arithmetic_mean();
+                    case geometric_mean: return stats.geometric_mean();
+                    case harmonic_mean: return stats.harmonic_mean();
+                    default: return NAN;
+                }
+            }
+
             void begin_()
             {
                 stream_filter_base::begin_();
-                samples = 0;
-                inverted_sum = sum = 0;
-                product = 1;
+                stats.clear();
+                for (auto &s: path_stats)
+                    s.clear();
+                candidates.clear();
+                candidate_starts.clear();
+                key_valid = false;
             }
 
             bool write_(const value &v, bool is_key)
@@ -671,58 +1098,120 @@ namespace cppdatalib
                 if (v.is_object() || v.is_array())
                     return false;
 
-                (void) is_key;
                 if (v.get_type() == measure)
-                {
-                    core::real_t value = v.as_real();
-
-                    ++samples;
+                    stats.add(v.as_real());
 
-                    sum += value;
-                    product *= value;
-                    inverted_sum += 1.0 / value;
+                if (is_key)
+                {
+                    key_valid = v.is_string();
+                    if (key_valid)
+                        key = v.get_string_unchecked();
                 }
+                else
+                    measure_paths(v);
+
                 output.write(v);
                 return true;
             }
+
+            void begin_array_(const value &v, int_t size, bool is_key)
+            {
+                begin_container(is_key);
+                stream_filter_base::begin_array_(v, size, is_key);
+            }
+            void end_array_(const value &v, bool is_key)
+            {
+                end_container();
+                stream_filter_base::end_array_(v, is_key);
+            }
+
+            void begin_object_(const value &v, int_t size, bool is_key)
+            {
+                begin_container(is_key);
+                stream_filter_base::begin_object_(v, size, is_key);
+            }
+            void end_object_(const value &v, bool is_key)
+            {
+                end_container();
+                stream_filter_base::end_object_(v, is_key);
+            }
+
+            void begin_string_(const value &v, int_t size, bool is_key)
+            {
+                if (is_key)
+                    key.clear();
+                stream_filter_base::begin_string_(v, size, is_key);
+            }
+            void string_data_(const value &v, bool is_key)
+            {
+                if (is_key)
+                    key += v.get_string_unchecked();
+                stream_filter_base::string_data_(v, is_key);
+            }
+            void end_string_(const value &v, bool is_key)
+            {
+                if (is_key)
+                    key_valid = true;
+                stream_filter_base::end_string_(v, is_key);
+            }
         };
 
+        // Computes the dispersion (variance and standard deviation) of the values of the specified type, in addition to the statistics
+        // computed by `mean_filter`. Only a constant amount of memory is used
         template<core::type measure = core::real>
         class dispersion_filter : public core::mean_filter<measure>
         {
             typedef core::mean_filter<measure> base;
 
-            core::value samples;
-            core::real_t variance_;
-            bool calculated;
-
         public:
             dispersion_filter(core::stream_handler &output)
                 : base(output)
-                , calculated(false)
+            {}
+            dispersion_filter(core::stream_handler &output, const std::vector<std::string> &paths, size_t record_depth = 0)
+                : base(output, paths, record_depth)
             {}
 
-            core::real_t get_variance()
-            {
-                if (!calculated && samples.is_array())
-                {
-                    variance_ = 0.0;
-                    for (auto const &sample: samples.get_array_unchecked())
-                        variance_ += pow(sample.as_real() - base::get_arithmetic_mean(), 2.0);
-                    calculated = true;
-                }
+            // Returns the population variance
+            core::real_t get_variance() const {return base::stats.variance();}
+            core::real_t get_standard_deviation() const {return base::stats.standard_deviation();}
 
-                return variance_ / base::sample_size();
-            }
+            core::real_t get_variance(const std::string &path) const {return base::get_statistics(path).variance();}
+            core::real_t get_standard_deviation(const std::string &path) const {return base::get_statistics(path).standard_deviation();}
+        };
+
+        template<core::type measure = core::real>
+        class quantile_filter : public impl::stream_filter_base
+        {
+            static_assert(measure == core::integer || measure == core::uinteger || measure == core::real, "cppdatalib::core::quantile_filter - measure must be a numeric type");
+
+            core::quantile_sketch sketch;
+
+        public:
+            // `compression` sets the accuracy (and memory use) of the quantile estimates. See `core::quantile_sketch`
+            quantile_filter(core::stream_handler &output, core::real_t compression = 100)
+                : stream_filter_base(output)
+                , sketch(compression)
+            {}
+
+            // Returns the estimated value at quantile `q` (0 <= q <= 1), or NaN if there are no samples
+            core::real_t get_quantile(core::real_t q) const {return sketch.quantile(q);}
+            core::real_t get_median() const {return get_quantile(0.5);}
 
-            core::real_t get_standard_deviation() {return sqrt(get_variance());}
+            const core::quantile_sketch &get_sketch() const {return sketch;}
+
+            // Adds the samples seen by `other` to this filter's estimates
+            void merge(const quantile_filter &other) {sketch.merge(other.sketch);}
+
+            size_t sample_size() const
+            {
+                return static_cast<size_t>(sketch.count());
+            }
 
         protected:
             void begin_()
             {
-                base::begin_();
-                samples.set_null();
-                calculated = false;
+                stream_filter_base::begin_();
+                sketch.clear();
             }
 
             bool write_(const value &v, bool is_key)
@@ -730,12 +1219,9 @@ namespace cppdatalib
                 if (v.is_object() || v.is_array())
                     return false;
 
-                base::write_(v, is_key);
+                stream_filter_base::write_(v, is_key);
                 if (v.get_type() == measure)
-                {
-                    samples.push_back(v);
-                    calculated = false;
-                }
+                    sketch.add(v.as_real());
                 return true;
             }
         };
@@ -743,19 +1229,38 @@ namespace cppdatalib
         template<core::type measure = core::real>
         class median_filter : public impl::stream_filter_base
         {
+            static const bool numeric = measure == core::integer || measure == core::uinteger || measure == core::real;
+
             core::value samples;
             bool sorted;
 
+            // Used instead of `samples` once the number of numeric samples exceeds `exact_limit`
+            core::quantile_sketch sketch;
+            bool estimating;
+            size_t exact_limit;
+
         public:
-            median_filter(core::stream_handler &output)
+            // The median is exact until more than `exact_limit` samples are seen. After that, numeric samples are summarized in
+            // a quantile sketch with the given compression, and the median is estimated in bounded memory.
+            // Non-numeric measures are always stored exactly
+            median_filter(core::stream_handler &output, size_t exact_limit = 65536, core::real_t compression = 200)
                 : stream_filter_base(output)
                 , sorted(false)
+                , sketch(compression)
+                , estimating(false)
+                , exact_limit(exact_limit)
             {}
 
+            // Returns true if the median returned by get_median() is an estimate
+            bool is_estimate() const {return estimating;}
+
             core::value get_median()
             {
                 using namespace std;
 
+                if (estimating)
+                    return sketch.quantile(0.5);
+
                 if (!sorted && samples.is_array())
                 {
                     sort(samples.get_array_ref().begin().data(), samples.get_array_ref().end().data());
@@ -773,7 +1278,7 @@ namespace cppdatalib
 
             size_t sample_size() const
             {
-                return samples.size();
+                return estimating? static_cast<size_t>(sketch.count()): samples.size();
             }
 
         protected:
@@ -782,6 +1287,8 @@ namespace cppdatalib
                 stream_filter_base::begin_();
                 samples.set_null();
                 sorted = false;
+                sketch.clear();
+                estimating = false;
             }
 
             bool write_(const value &v, bool is_key)
@@ -792,8 +1299,22 @@ namespace cppdatalib
                 stream_filter_base::write_(v, is_key);
                 if (v.get_type() == measure)
                 {
-                    samples.push_back(v);
-                    sorted = false;
+                    if (estimating)
+                        sketch.add(v.as_real());
+                    else
+                    {
+                        samples.push_back(v);
+                        sorted = false;
+
+                        if (numeric && samples.array_size() > exact_limit)
+                        {
+                            // Switch to estimation, and release the stored samples
+                            for (auto const &sample: samples.get_array_unchecked())
+                                sketch.add(sample.as_real());
+                            samples.set_null();
+                            estimating = true;
+                        }
+                    }
                 }
                 return true;
             }
@@ -802,16 +1323,34 @@ namespace cppdatalib
         template<core::type measure = core::real>
         class mode_filter : public impl::stream_filter_base
         {
-            core::value samples;
+            std::unordered_map<core::value, core::uint_t> samples;
+            core::frequent_items_sketch sketch;
+            bool estimating;
             core::value modes;
             bool calculated;
 
         public:
+            typedef core::frequent_items_sketch::item item;
+
+            // Counts every distinct value exactly
             mode_filter(core::stream_handler &output)
                 : stream_filter_base(output)
+                , estimating(false)
+                , calculated(false)
+            {}
+
+            // Estimates frequencies in bounded memory, tracking at most `capacity` distinct values
+            // Any value occurring in more than 1/`capacity` of the samples is guaranteed to be tracked
+            mode_filter(core::stream_handler &output, size_t capacity)
+                : stream_filter_base(output)
+                , sketch(capacity)
+                , estimating(true)
                 , calculated(false)
             {}
 
+            // Returns true if frequencies are estimated
+            bool is_estimate() const {return estimating;}
+
             const core::value &get_modes()
             {
                 using namespace std;
@@ -819,39 +1358,76 @@ namespace cppdatalib
                 if (!calculated)
                 {
                     core::uint_t max_frequency = 1;
+                    size_t distinct = 0;
                     modes.set_null();
 
-                    if (samples.is_object())
+                    if (estimating)
+                    {
+                        std::vector<item> items = sketch.top(sketch.size());
+
+                        if (!items.empty())
+                            max_frequency = items.front().count;
+
+                        for (const auto &i: items)
+                            if (i.count == max_frequency)
+                                modes.push_back(i.value);
+
+                        distinct = items.size();
+                    }
+                    else
                     {
-                        for (const auto &item: samples.get_object_unchecked())
-                            max_frequency = std::max(item.second.get_uint_unchecked(), max_frequency); // Don't worry about get_uint_unchecked, we know all values are unsigned integers
+                        for (const auto &item: samples)
+                            max_frequency = std::max(item.second, max_frequency);
 
-                        for (const auto &item: samples.get_object_unchecked())
+                        for (const auto &item: samples)
                         {
-                            if (item.second.get_uint_unchecked() == max_frequency)
+                            if (item.second == max_frequency)
                                 modes.push_back(item.first);
                         }
 
-                        if (modes.size() == samples.size())
-                            modes.set_null();
+                        distinct = samples.size();
                     }
 
+                    if (modes.size() == distinct)
+                        modes.set_null();
+                    else if (modes.is_array()) // Report modes in ascending order, regardless of hashing
+                        sort(modes.get_array_ref().begin().data(), modes.get_array_ref().end().data());
+
                     calculated = true;
                 }
 
                 return modes;
             }
 
+            // Returns up to `k` values with the highest frequencies, most frequent first, with their frequencies and error bounds
+            // (the error bound is always 0 when counting exactly)
+            std::vector<item> get_top(size_t k) const
+            {
+                if (estimating)
+                    return sketch.top(k);
+
+                std::vector<item> result;
+                for (const auto &i: samples)
+                    result.push_back(item(i.first, i.second, 0));
+
+                k = std::min(k, result.size());
+                std::partial_sort(result.begin(), result.begin() + k, result.end(), [](const item &a, const item &b) {return a.count > b.count;});
+                result.resize(k);
+
+                return result;
+            }
+
             size_t sample_size() const
             {
-                return samples.size();
+                return estimating? sketch.size(): samples.size();
             }
 
         protected:
             void begin_()
             {
                 stream_filter_base::begin_();
-                samples.set_null();
+                samples.clear();
+                sketch.clear();
                 calculated = false;
             }
 
@@ -863,195 +1439,1728 @@ namespace cppdatalib
                 stream_filter_base::write_(v, is_key);
                 if (v.get_type() == measure)
                 {
-                    samples.member(v).get_uint_ref() += 1;
+                    if (estimating)
+                        sketch.add(v);
+                    else
+                        samples[v] += 1;
                     calculated = false;
                 }
                 return true;
             }
         };
 
+        // Estimates the number of distinct values of the specified type, in bounded memory
+        //
+        // If `path` is not empty, only values at or below the locations it refers to are counted. `path` is a JSON pointer (e.g. "/users/*/id"),
+        // matched like the paths of `path_extract_filter`, so the reference token "*" matches any array element. Object keys themselves are never counted
+        template<core::type measure = core::real>
+        class cardinality_filter : public core::buffer_filter
+        {
+            static_assert(measure != core::array && measure != core::object, "cppdatalib::core::cardinality_filter - measure must be a scalar type or string");
+
+            struct frame
+            {
+                frame(int state, bool counted) : state(state), member_state(impl::pointer_automaton::dead), counted(counted) {}
+
+                int state; // State of this container in the path automaton
+                int member_state; // For objects, the state of the value of the current key
+                bool counted; // True if this container is at or below a location matched by the path
+            };
+
+            core::cardinality_sketch sketch;
+            impl::pointer_automaton automaton;
+            std::vector<frame> frames;
+            core::string_t key;
+            bool string_counted;
+
+            // Returns the state of the element about to begin in the current container
+            int element_state() const
+            {
+                if (nesting_depth() == 0)
+                    return automaton.start();
+                else if (current_container() == core::array)
+                    return automaton.index_transition(frames.back().state, current_container_size());
+                return frames.back().member_state;
+            }
+
+            // Returns true if the element about to begin in the current container should be counted
+            bool element_counted() const {return frames.back().counted || automaton.accepting(element_state());}
+
+            // Called with the entire key of the innermost object
+            void set_key(const core::value &v)
+            {
+                frames.back().member_state = v.is_string()? automaton.key_transition(frames.back().state, v.get_string_unchecked()): int(impl::pointer_automaton::dead);
+            }
+
+            void begin_container(bool is_key)
+            {
+                if (is_key) // Complex keys are never on the path
+                {
+                    frames.back().member_state = impl::pointer_automaton::dead;
+                    frames.push_back(frame(impl::pointer_automaton::dead, false));
+                }
+                else
+                    frames.push_back(frame(element_state(), element_counted()));
+            }
+
+        public:
+            // `precision` sets the accuracy (and memory use) of the estimate. See `core::cardinality_sketch`
+            cardinality_filter(core::stream_handler &output, const std::string &path = std::string(), int precision = 12)
+                : buffer_filter(output, measure == core::string? buffer_strings: buffer_none)
+                , sketch(precision)
+                , string_counted(false)
+            {
+                if (!automaton.compile(std::vector<std::string>(1, path)))
+                    throw core::error("cppdatalib::core::cardinality_filter - invalid path");
+            }
+
+            // Returns the estimated number of distinct values seen
+            core::real_t get_cardinality() const {return sketch.estimate();}
+
+            const core::cardinality_sketch &get_sketch() const {return sketch;}
+
+            // Adds the values seen by `other` (e.g. in another thread or file) to this filter's estimate
+            void merge(const cardinality_filter &other) {sketch.merge(other.sketch);}
+            void merge(const core::cardinality_sketch &other) {sketch.merge(other);}
+
+        protected:
+            void begin_()
+            {
+                buffer_filter::begin_();
+                sketch.clear();
+                frames.assign(1, frame(impl::pointer_automaton::dead, false));
+                string_counted = false;
+            }
+
+            void write_buffered_value_(const value &v, bool is_key)
+            {
+                if (!is_key && string_counted && v.get_type() == measure)
+                    sketch.add(v);
+                buffer_filter::write_buffered_value_(v, is_key);
+            }
+
+            bool write_(const value &v, bool is_key)
+            {
+                if (v.is_object() || v.is_array())
+                    return false;
+
+                if (is_key)
+                    set_key(v);
+                else if (v.get_type() == measure && element_counted())
+                    sketch.add(v);
+                return buffer_filter::write_(v, is_key);
+            }
+
+            void begin_array_(const value &v, int_t size, bool is_key)
+            {
+                begin_container(is_key);
+                buffer_filter::begin_array_(v, size, is_key);
+            }
+            void end_array_(const value &v, bool is_key)
+            {
+                buffer_filter::end_array_(v, is_key);
+                frames.pop_back();
+            }
+
+            void begin_object_(const value &v, int_t size, bool is_key)
+            {
+                begin_container(is_key);
+                buffer_filter::begin_object_(v, size, is_key);
+            }
+            void end_object_(const value &v, bool is_key)
+            {
+                buffer_filter::end_object_(v, is_key);
+                frames.pop_back();
+            }
+
+            void begin_string_(const value &v, int_t size, bool is_key)
+            {
+                if (is_key)
+                    key.clear();
+                else
+                    string_counted = element_counted();
+                buffer_filter::begin_string_(v, size, is_key);
+            }
+            void string_data_(const value &v, bool is_key)
+            {
+                if (is_key)
+                    key += v.get_string_unchecked();
+                buffer_filter::string_data_(v, is_key);
+            }
+            void end_string_(const value &v, bool is_key)
+            {
+                if (is_key)
+                    set_key(core::value(key));
+                buffer_filter::end_string_(v, is_key);
+            }
+        };
+
+        enum sampling_method
+        {
+            bernoulli_sampling, // Each element is kept independently, with a fixed probability
+            reservoir_sampling, // A fixed number of elements is kept, chosen uniformly
+            stratified_sampling // A fixed number of elements is kept for each distinct value of a field, chosen uniformly
+        };
+
+        // Outputs a random sample of the elements at a specified depth, rather than all of them. `element_depth` specifies the nesting depth
+        // of the elements to sample (with 0 being top-level values, such as in an NDJSON stream, and 1 being the elements of a top-level array).
+        // Only elements of arrays (or top-level values) are sampled; other values are passed through unchanged.
+        //
+        // `parameter` is the probability of keeping each element for Bernoulli sampling, and the sample size otherwise.
+        // For stratified sampling, `stratum_path` is a JSON pointer to the field (relative to each element) that selects the stratum.
+        //
+        // Bernoulli samples are written as the input is read. Other samples are written, in their original order, when the array ends (or at `end()`,
+        // for top-level values). Elements that are not selected are skipped without being built, except in stratified sampling, where the
+        // field value must be read first. If `seed` is 0, a random seed is used
+        class sampling_filter : public core::buffer_filter
+        {
+            // The state of Algorithm L, which chooses `k` items uniformly from a stream of unknown length, in O(k(1 + log(n/k))) random numbers
+            struct reservoir
+            {
+                std::vector<std::pair<uint64_t, core::value>> items; // Index in stream and value of each sampled item
+                uint64_t seen;
+                uint64_t next; // Index of the next item to be sampled, once the reservoir is full
+                double w;
+
+                reservoir() : seen(0), next(0), w(0) {}
+
+                // Returns the slot the next item should be stored in, or -1 if it is not sampled. This must be called exactly once for each item
+                size_t next_slot(size_t k, std::mt19937_64 &rng)
+                {
+                    const uint64_t index = seen++;
+
+                    if (items.size() < k)
+                    {
+                        if (items.size() + 1 == k)
+                        {
+                            w = std::exp(std::log(random(rng)) / k);
+                            skip(index, rng);
+                        }
+                        return items.size();
+                    }
+                    else if (index != next || k == 0)
+                        return size_t(-1);
+
+                    w *= std::exp(std::log(random(rng)) / k);
+                    skip(index, rng);
+                    return std::uniform_int_distribution<size_t>(0, k - 1)(rng);
+                }
+
+                void store(size_t slot, uint64_t index, core::value &&v)
+                {
+                    if (slot == items.size())
+                        items.push_back(std::make_pair(index, std::move(v)));
+                    else
+                        items[slot] = std::make_pair(index, std::move(v));
+                }
+
+            private:
+                // Returns a random number in (0, 1)
+                static double random(std::mt19937_64 &rng)
+                {
+                    double r;
+                    do
+                        r = std::uniform_real_distribution<double>(0, 1)(rng);
+                    while (r == 0);
+                    return r;
+                }
+
+                void skip(uint64_t index, std::mt19937_64 &rng)
+                {
+                    const double gap = std::floor(std::log(random(rng)) / std::log1p(-w));
+                    next = gap < 1e18? index + 1 + static_cast<uint64_t>(gap): UINT64_MAX;
+                }
+            };
+
+            enum decision
+            {
+                skip_element,
+                pass_element,
+                keep_element
+            };
+
+            const sampling_method method;
+            const double probability;
+            const size_t sample_size;
+            impl::pointer_path stratum_path;
+            const size_t element_depth;
+            std::mt19937_64 rng;
+
+            reservoir sample;
+            std::unordered_map<core::value, reservoir> strata;
+            uint64_t element_index;
+            size_t pending_slot; // Reservoir slot of the element being built
+
+            // Returns true if the next value begins an element to be sampled
+            bool at_element() const
+            {
+                return ignore_nesting == 0 && !cache.active() && nesting_depth() == element_depth &&
+                        (element_depth == 0 || current_container() == core::array);
+            }
+
+            // Returns true if the next value is an array whose elements are sampled
+            bool at_sampled_array() const
+            {
+                return ignore_nesting == 0 && !cache.active() && nesting_depth() + 1 == element_depth;
+            }
+
+            decision decide()
+            {
+                switch (method)
+                {
+                    case bernoulli_sampling:
+                        ++element_index;
+                        return std::uniform_real_distribution<double>(0, 1)(rng) < probability? pass_element: skip_element;
+                    case reservoir_sampling:
+                        pending_slot = sample.next_slot(sample_size, rng);
+                        if (pending_slot == size_t(-1))
+                        {
+                            ++element_index;
+                            return skip_element;
+                        }
+                        return keep_element;
+                    default:
+                        return keep_element;
+                }
+            }
+
+            void store(core::value &&v)
+            {
+                const uint64_t index = element_index++;
+
+                if (method == reservoir_sampling)
+                    sample.store(pending_slot, index, std::move(v));
+                else
+                {
+                    const core::value *key = stratum_path.evaluate(v);
+                    reservoir &r = strata[key? *key: core::value()];
+                    const size_t slot = r.next_slot(sample_size, rng);
+
+                    if (slot != size_t(-1))
+                        r.store(slot, index, std::move(v));
+                }
+            }
+
+            void reset_samples()
+            {
+                sample = reservoir();
+                strata.clear();
+                element_index = 0;
+            }
+
+            // Writes the samples (other than for Bernoulli sampling), in their original order
+            void write_samples()
+            {
+                std::vector<std::pair<uint64_t, core::value>> items(std::move(sample.items));
+
+                for (auto &stratum: strata)
+                    for (auto &item: stratum.second.items)
+                        items.push_back(std::move(item));
+
+                std::sort(items.begin(), items.end(), [](const std::pair<uint64_t, core::value> &a, const std::pair<uint64_t, core::value> &b) {return a.first < b.first;});
+                for (const auto &item: items)
+                    output.write(item.second);
+
+                reset_samples();
+            }
+
+        public:
+            sampling_filter(core::stream_handler &output, sampling_method method, double parameter, const std::string &stratum_path = std::string(), size_t element_depth = 1, uint64_t seed = 0)
+                : buffer_filter(output, buffer_none)
+                , method(method)
+                , probability(parameter)
+                , sample_size(method == bernoulli_sampling? 0: static_cast<size_t>(parameter))
+                , element_depth(element_depth)
+                , rng(seed? seed: std::random_device()())
+                , element_index(0)
+                , pending_slot(0)
+            {
+                if (method == bernoulli_sampling && !(parameter >= 0 && parameter <= 1))
+                    throw core::error("cppdatalib::core::sampling_filter - sampling probability must be between 0 and 1");
+                else if (method != bernoulli_sampling && !(parameter >= 0))
+                    throw core::error("cppdatalib::core::sampling_filter - sample size must not be negative");
+                else if (!this->stratum_path.parse(stratum_path))
+                    throw core::error("cppdatalib::core::sampling_filter - invalid stratum path");
+            }
+
+        protected:
+            void begin_()
+            {
+                buffer_filter::begin_();
+                reset_samples();
+            }
+            void end_()
+            {
+                if (element_depth == 0)
+                    write_samples();
+                buffer_filter::end_();
+            }
+
+            void write_buffered_value_(const value &v, bool)
+            {
+                store(core::value(v));
+            }
+
+            bool write_(const value &v, bool is_key)
+            {
+                if (at_element())
+                {
+                    switch (decide())
+                    {
+                        case skip_element: break;
+                        case pass_element: output.write(v); break;
+                        case keep_element: store(core::value(v)); break;
+                    }
+                    return true;
+                }
+                else if ((v.is_array() || v.is_object()) && ignore_nesting == 0 && !cache.active() && nesting_depth() < element_depth)
+                    return false; // Expand the value so its elements are sampled
+
+                return buffer_filter::write_(v, is_key);
+            }
+
+            void begin_array_(const value &v, int_t size, bool is_key)
+            {
+                if (at_element())
+                {
+                    switch (decide())
+                    {
+                        case skip_element: ignore_nesting = 1; break;
+                        case pass_element: buffer_filter::begin_array_(v, size, is_key); break;
+                        case keep_element: cache.begin(); cache.begin_array(v, size); break;
+                    }
+                }
+                else if (at_sampled_array())
+                {
+                    reset_samples();
+                    output.begin_array(core::value(core::array_t(), v.get_subtype()), stream_handler::unknown_size);
+                }
+                else
+                    buffer_filter::begin_array_(v, size, is_key);
+            }
+            void end_array_(const value &v, bool is_key)
+            {
+                if (ignore_nesting == 0 && !cache.active() && nesting_depth() == element_depth)
+                {
+                    write_samples();
+                    output.end_array(core::value(core::array_t(), v.get_subtype()));
+                }
+                else
+                    buffer_filter::end_array_(v, is_key);
+            }
+
+            void begin_object_(const value &v, int_t size, bool is_key)
+            {
+                if (at_element())
+                {
+                    switch (decide())
+                    {
+                        case skip_element: ignore_nesting = 1; break;
+                        case pass_element: buffer_filter::begin_object_(v, size, is_key); break;
+                        case keep_element: cache.begin(); cache.begin_object(v, size); break;
+                    }
+                }
+                else
+                    buffer_filter::begin_object_(v, size, is_key);
+            }
+
+            void begin_string_(const value &v, int_t size, bool is_key)
+            {
+                if (at_element())
+                {
+                    switch (decide())
+                    {
+                        case skip_element: ignore_nesting = 1; break;
+                        case pass_element: buffer_filter::begin_string_(v, size, is_key); break;
+                        case keep_element: cache.begin(); cache.begin_string(v, size); break;
+                    }
+                }
+                else
+                    buffer_filter::begin_string_(v, size, is_key);
+            }
+        };
+
         enum sort_filter_flag
         {
             ascending_sort,
             descending_sort
         };
 
-        template<sort_filter_flag direction = ascending_sort>
-        class array_sort_filter : public core::buffer_filter
-        {
+        template<sort_filter_flag direction = ascending_sort>
+        class array_sort_filter : public core::buffer_filter
+        {
+        public:
+            array_sort_filter(core::stream_handler &output, size_t nesting_level = 0)
+                : core::buffer_filter(output, buffer_arrays, nesting_level)
+            {}
+
+        protected:
+            void write_buffered_value_(const value &v, bool is_key)
+            {
+                using namespace std;
+
+                if (v.get_type() == core::array)
+                {
+                    core::value sorted = v;
+
+                    if (direction == ascending_sort)
+                        sort(sorted.get_array_ref().data().begin(), sorted.get_array_ref().data().end());
+                    else
+						sort(sorted.get_array_ref().data().begin(), sorted.get_array_ref().data().end(), std::greater<cppdatalib::core::value>());
+
+                    buffer_filter::write_buffered_value_(sorted, is_key);
+                }
+                else
+                    buffer_filter::write_buffered_value_(v, is_key);
+            }
+        };
+
+        namespace impl
+        {
+            // Appends a sort key for `v` (or for a missing value, if `v` is NULL) to `key`, such that comparing keys bytewise gives the
+            // sort order of the values. Missing values sort first, then null, false, true, numbers (by numeric value, regardless of type),
+            // strings (bytewise), arrays, and objects. Each key is self-delimiting, so keys for multiple fields can be concatenated
+            class sort_key_encoder
+            {
+                enum rank
+                {
+                    end_of_container,
+                    missing,
+                    null,
+                    false_,
+                    true_,
+                    number,
+                    string,
+                    array,
+                    object
+                };
+
+                std::string &key;
+
+                void put_uint64(uint64_t v)
+                {
+                    for (int shift = 56; shift >= 0; shift -= 8)
+                        key.push_back(static_cast<char>((v >> shift) & 0xff));
+                }
+
+                // Numbers are ordered by their value as a double, then exactly, as a 65-bit integer, to break ties between large integers
+                void put_number(double d, bool exact_is_negative, uint64_t exact)
+                {
+                    uint64_t bits;
+
+                    if (d == 0)
+                        d = 0;
+                    else if (std::isnan(d))
+                        d = NAN;
+
+                    memcpy(&bits, &d, sizeof(bits));
+                    bits = (bits >> 63)? ~bits: bits | (uint64_t(1) << 63);
+
+                    key.push_back(number);
+                    put_uint64(bits);
+                    key.push_back(exact_is_negative? 0: 1);
+                    put_uint64(exact);
+                }
+
+                void put_node(const core::value &v)
+                {
+                    switch (v.get_type())
+                    {
+                        case core::null: key.push_back(null); break;
+                        case core::boolean: key.push_back(v.get_bool_unchecked()? true_: false_); break;
+                        case core::integer:
+                            put_number(static_cast<double>(v.get_int_unchecked()), v.get_int_unchecked() < 0, static_cast<uint64_t>(v.get_int_unchecked()));
+                            break;
+                        case core::uinteger:
+                            put_number(static_cast<double>(v.get_uint_unchecked()), false, v.get_uint_unchecked());
+                            break;
+                        case core::real:
+                        {
+                            const double d = static_cast<double>(v.get_real_unchecked());
+
+                            // Only integral reals can have the same double value as a different number
+                            if (d >= -9223372036854775808.0 && d < 0 && std::floor(d) == d)
+                                put_number(d, true, static_cast<uint64_t>(static_cast<int64_t>(d)));
+                            else if (d >= 0 && d < 18446744073709551616.0 && std::floor(d) == d)
+                                put_number(d, false, static_cast<uint64_t>(d));
+                            else
+                                put_number(d, false, 0);
+                            break;
+                        }
+                        case core::string:
+                            key.push_back(string);
+                            for (char c: v.get_string_unchecked())
+                            {
+                                key.push_back(c);
+                                if (c == 0)
+                                    key.push_back(static_cast<char>(0xff));
+                            }
+                            key.push_back(0);
+                            key.push_back(0);
+                            break;
+                        case core::array: key.push_back(array); break;
+                        case core::object: key.push_back(object); break;
+                    }
+                }
+
+            public:
+                sort_key_encoder(std::string &key) : key(key) {}
+
+                bool operator()(const core::value *arg, core::value::traversal_ancestry_finder, bool prefix)
+                {
+                    if (prefix)
+                        put_node(*arg);
+                    else if (arg->is_array() || arg->is_object())
+                        key.push_back(end_of_container);
+                    return true;
+                }
+
+                void append(const core::value *v, bool descending)
+                {
+                    const size_t start = key.size();
+
+                    if (v == NULL)
+                        key.push_back(missing);
+                    else if (v->is_array() || v->is_object())
+                        v->traverse(*this);
+                    else
+                        put_node(*v);
+
+                    // Inverting a self-delimiting key reverses its order
+                    if (descending)
+                        for (size_t i = start; i < key.size(); ++i)
+                            key[i] = ~key[i];
+                }
+            };
+        }
+
+        // Sorts all arrays deeper than the specified nesting level (or all arrays, if 0 is specified) by one or more fields of their elements.
+        // Fields are specified as JSON pointers relative to each element (e.g. "/timestamp" or "/user/id"), each with its own direction.
+        // Elements are compared by the first field, then by the second field if equal, and so on. Elements with equal keys keep their original order.
+        // Elements missing a field sort before all other elements for that field (after, if the field is sorted in descending order)
+        //
+        // Each element's key is computed once, in a byte string that sorts like the fields themselves. Large arrays are sorted in parallel
+        // on the threads of `executor`, if one is given (it must outlive the filter)
+        class keyed_sort_filter : public core::buffer_filter
+        {
+        public:
+            typedef std::pair<std::string, sort_filter_flag> field;
+
+        private:
+            std::vector<std::pair<impl::pointer_path, sort_filter_flag>> fields;
+            parallel_executor * const executor;
+
+            void add_field(const std::string &path, sort_filter_flag direction)
+            {
+                impl::pointer_path p;
+
+                if (!p.parse(path))
+                    throw core::error("cppdatalib::core::keyed_sort_filter - invalid field path");
+
+                fields.push_back(std::make_pair(std::move(p), direction));
+            }
+
+        public:
+            keyed_sort_filter(core::stream_handler &output, const std::string &path, sort_filter_flag direction = ascending_sort, size_t nesting_level = 0, parallel_executor *executor = NULL)
+                : core::buffer_filter(output, buffer_arrays, nesting_level)
+                , executor(executor)
+            {
+                add_field(path, direction);
+            }
+            keyed_sort_filter(core::stream_handler &output, const std::vector<field> &fields, size_t nesting_level = 0, parallel_executor *executor = NULL)
+                : core::buffer_filter(output, buffer_arrays, nesting_level)
+                , executor(executor)
+            {
+                for (const auto &f: fields)
+                    add_field(f.first, f.second);
+            }
+
+        protected:
+            void write_buffered_value_(const value &v, bool is_key)
+            {
+                if (v.get_type() != core::array)
+                {
+                    buffer_filter::write_buffered_value_(v, is_key);
+                    return;
+                }
+
+                const core::array_t::container_type &elements = v.get_array_unchecked().data();
+                std::vector<std::string> keys(elements.size());
+                std::vector<size_t> order(elements.size());
+
+                impl::parallel_parts(elements.size(), executor, 1024, [&](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        impl::sort_key_encoder encoder(keys[i]);
+
+                        for (const auto &f: fields)
+                            encoder.append(f.first.evaluate(elements[i]), f.second == descending_sort);
+                        order[i] = i;
+                    }
+                });
+
+                impl::parallel_sort(order.begin(), order.end(), [&keys](size_t a, size_t b)
+                {
+                    const int compare = keys[a].compare(keys[b]);
+                    return compare < 0 || (compare == 0 && a < b);
+                }, executor);
+
+                output.begin_array(core::value(core::array_t(), v.get_subtype()), elements.size());
+                for (size_t i: order)
+                    output.write(elements[i]);
+                output.end_array(core::value(core::array_t(), v.get_subtype()));
+            }
+        };
+
+        // Outputs only the `k` elements with the greatest (or, with `ascending_sort`, the least) keys, in order, from each array at a specified depth.
+        // `element_depth` specifies the nesting depth of the elements (with 0 being top-level values, such as in an NDJSON stream,
+        // and 1 being the elements of a top-level array). The key of each element is found with the JSON pointer `key_path`, relative to the element,
+        // and keys are ordered as in `keyed_sort_filter`. Elements with equal keys keep their original order, and elements without a key are never output.
+        //
+        // Only `k` elements are kept in memory. As soon as an element's key is read, the element is rejected if it cannot be one of the `k` best elements,
+        // and the remainder of the element is skipped without being built
+        class top_k_filter : public core::buffer_filter
+        {
+            struct entry
+            {
+                std::string key; // Sort key, as encoded by `impl::sort_key_encoder`, such that lesser keys are better
+                uint64_t index; // Index of the element in the input
+                core::value value;
+
+                bool operator<(const entry &other) const
+                {
+                    const int compare = key.compare(other.key);
+                    return compare < 0 || (compare == 0 && index < other.index);
+                }
+            };
+
+            struct frame
+            {
+                frame(bool on_path) : on_path(on_path), key_matches(false) {}
+
+                bool on_path; // True if this container of the current element is on the key path
+                bool key_matches; // For objects, true if the current key matches the corresponding token of the key path
+            };
+
+            const size_t k;
+            impl::pointer_path path;
+            const sort_filter_flag direction;
+            const size_t element_depth;
+
+            std::vector<entry> heap; // Max-heap, with the worst entry on top
+            uint64_t element_index;
+
+            // The element being built
+            core::value element;
+            core::value_builder builder;
+            std::vector<frame> frames;
+            std::string key;
+            bool key_found;
+
+            // Object keys and the key value are collected here when they are provided as string pieces
+            core::string_t string_buffer;
+            bool string_is_key_value;
+
+            bool building() const {return builder.active();}
+
+            // Returns true if the next value begins an element
+            bool at_element() const
+            {
+                return ignore_nesting == 0 && !building() && nesting_depth() == element_depth &&
+                        (element_depth == 0 || current_container() == core::array);
+            }
+
+            // Returns true if the next value is an array whose elements are selected from
+            bool at_selected_array() const
+            {
+                return ignore_nesting == 0 && !building() && nesting_depth() + 1 == element_depth;
+            }
+
+            // Returns true if the next value in the element being built is at the key path
+            bool at_key_value() const
+            {
+                const size_t depth = builder.nesting_depth();
+
+                if (depth != path.size() || (depth > 0 && !frames.back().on_path))
+                    return false;
+                else if (depth == 0)
+                    return true;
+                else if (builder.current_container() == core::array)
+                    return path.indexes[depth - 1] == builder.current_container_size();
+                return frames.back().key_matches;
+            }
+
+            // Returns true if the next container in the element being built is on the key path
+            bool container_on_path() const
+            {
+                const size_t depth = builder.nesting_depth();
+
+                if (depth == 0)
+                    return true;
+                else if (depth > path.size() || !frames.back().on_path)
+                    return false;
+                else if (builder.current_container() == core::array)
+                    return path.indexes[depth - 1] == builder.current_container_size();
+                return frames.back().key_matches;
+            }
+
+            std::string encode_key(const core::value *v) const
+            {
+                std::string result;
+                impl::sort_key_encoder(result).append(v, direction == descending_sort);
+                return result;
+            }
+
+            bool can_enter(const std::string &key) const
+            {
+                return k > 0 && (heap.size() < k || key < heap.front().key);
+            }
+
+            void push(std::string &&key, core::value &&v)
+            {
+                if (!can_enter(key))
+                    return;
+                else if (heap.size() == k)
+                {
+                    std::pop_heap(heap.begin(), heap.end());
+                    heap.pop_back();
+                }
+
+                heap.push_back(entry{std::move(key), element_index, std::move(v)});
+                std::push_heap(heap.begin(), heap.end());
+            }
+
+            void begin_element()
+            {
+                builder.begin();
+                frames.clear();
+                key_found = false;
+            }
+
+            void end_element()
+            {
+                builder.end();
+                if (!key_found)
+                {
+                    const core::value *v = path.evaluate(element);
+                    if (v == NULL) // Elements without a key are never selected
+                    {
+                        ++element_index;
+                        return;
+                    }
+
+                    key = encode_key(v);
+                }
+
+                push(std::move(key), std::move(element));
+                ++element_index;
+            }
+
+            // Called when the key value of the element being built has been read
+            void found_key(const core::value &v)
+            {
+                key = encode_key(&v);
+                key_found = true;
+
+                if (can_enter(key))
+                    return;
+
+                // The element is rejected, so close the partially built element and skip the rest of it
+                while (builder.nesting_depth() > 0)
+                {
+                    if (builder.current_container() == core::array)
+                        builder.end_array(core::array_t());
+                    else
+                        builder.end_object(core::object_t());
+                }
+                builder.end();
+
+                ignore_nesting = frames.size();
+                ++element_index;
+            }
+
+            void set_object_key(const core::value &v)
+            {
+                const size_t depth = builder.nesting_depth();
+                frames.back().key_matches = depth <= path.size() && path.key_matches(depth - 1, v);
+            }
+
+            void begin_container(bool is_key)
+            {
+                if (is_key)
+                {
+                    frames.back().key_matches = false;
+                    frames.push_back(frame(false));
+                }
+                else
+                    frames.push_back(frame(container_on_path()));
+            }
+
+            // Writes the selected elements, best first
+            void write_selected()
+            {
+                std::sort(heap.begin(), heap.end());
+                for (const auto &e: heap)
+                    output.write(e.value);
+
+                heap.clear();
+                element_index = 0;
+            }
+
+        public:
+            top_k_filter(core::stream_handler &output, size_t k, const std::string &key_path, sort_filter_flag direction = descending_sort, size_t element_depth = 1)
+                : buffer_filter(output, buffer_none)
+                , k(k)
+                , direction(direction)
+                , element_depth(element_depth)
+                , element_index(0)
+                , builder(element)
+                , key_found(false)
+                , string_is_key_value(false)
+            {
+                if (!path.parse(key_path))
+                    throw core::error("cppdatalib::core::top_k_filter - invalid key path");
+            }
+
+        protected:
+            void begin_()
+            {
+                buffer_filter::begin_();
+                heap.clear();
+                element_index = 0;
+            }
+            void end_()
+            {
+                if (element_depth == 0)
+                    write_selected();
+                buffer_filter::end_();
+            }
+
+            bool write_(const value &v, bool is_key)
+            {
+                if (building())
+                {
+                    if (is_key)
+                    {
+                        set_object_key(v);
+                        builder.write(v);
+                    }
+                    else if (at_key_value())
+                    {
+                        builder.write(v);
+                        found_key(v);
+                    }
+                    else
+                        builder.write(v);
+
+                    return true;
+                }
+                else if (at_element())
+                {
+                    const core::value *key_value = path.evaluate(v);
+
+                    if (key_value != NULL)
+                    {
+                        std::string key = encode_key(key_value);
+
+                        if (can_enter(key))
+                            push(std::move(key), core::value(v));
+                    }
+                    ++element_index;
+                    return true;
+                }
+                else if ((v.is_array() || v.is_object()) && ignore_nesting == 0 && nesting_depth() < element_depth)
+                    return false; // Expand the value so its elements are selected from
+
+                return buffer_filter::write_(v, is_key);
+            }
+
+            void begin_array_(const value &v, int_t size, bool is_key)
+            {
+                if (building() || at_element())
+                {
+                    if (!building())
+                        begin_element();
+
+                    begin_container(is_key);
+                    builder.begin_array(v, size);
+                }
+                else if (at_selected_array())
+                {
+                    heap.clear();
+                    element_index = 0;
+                    output.begin_array(core::value(core::array_t(), v.get_subtype()), stream_handler::unknown_size);
+                }
+                else
+                    buffer_filter::begin_array_(v, size, is_key);
+            }
+            void end_array_(const value &v, bool is_key)
+            {
+                if (building())
+                {
+                    builder.end_array(v);
+                    frames.pop_back();
+                    if (builder.nesting_depth() == 0)
+                        end_element();
+                }
+                else if (ignore_nesting == 0 && nesting_depth() == element_depth)
+                {
+                    write_selected();
+                    output.end_array(core::value(core::array_t(), v.get_subtype()));
+                }
+                else
+                    buffer_filter::end_array_(v, is_key);
+            }
+
+            void begin_object_(const value &v, int_t size, bool is_key)
+            {
+                if (building() || at_element())
+                {
+                    if (!building())
+                        begin_element();
+
+                    begin_container(is_key);
+                    builder.begin_object(v, size);
+                }
+                else
+                    buffer_filter::begin_object_(v, size, is_key);
+            }
+            void end_object_(const value &v, bool is_key)
+            {
+                if (building())
+                {
+                    builder.end_object(v);
+                    frames.pop_back();
+                    if (builder.nesting_depth() == 0)
+                        end_element();
+                }
+                else
+                    buffer_filter::end_object_(v, is_key);
+            }
+
+            void begin_string_(const value &v, int_t size, bool is_key)
+            {
+                if (building() || at_element())
+                {
+                    if (!building())
+                        begin_element();
+
+                    string_is_key_value = !is_key && at_key_value();
+                    string_buffer.clear();
+                    builder.begin_string(v, size);
+                }
+                else
+                    buffer_filter::begin_string_(v, size, is_key);
+            }
+            void string_data_(const value &v, bool is_key)
+            {
+                if (building())
+                {
+                    if (is_key || string_is_key_value)
+                        string_buffer += v.get_string_unchecked();
+                    builder.append_to_string(v);
+                }
+                else
+                    buffer_filter::string_data_(v, is_key);
+            }
+            void end_string_(const value &v, bool is_key)
+            {
+                if (building())
+                {
+                    builder.end_string(v);
+
+                    if (is_key)
+                        set_object_key(core::value(string_buffer));
+                    else if (builder.nesting_depth() == 0)
+                        end_element();
+                    else if (string_is_key_value)
+                        found_key(core::value(string_buffer));
+                }
+                else
+                    buffer_filter::end_string_(v, is_key);
+            }
+        };
+
+        class table_to_array_of_maps_filter : public core::buffer_filter
+        {
+            core::value column_names;
+            bool fail_on_missing_column;
+
+        public:
+            table_to_array_of_maps_filter(core::stream_handler &output, const core::value &column_names, bool fail_on_missing_column = false)
+                : core::buffer_filter(output, buffer_arrays, 1)
+                , column_names(column_names)
+                , fail_on_missing_column(fail_on_missing_column)
+            {}
+
+        protected:
+            void write_buffered_value_(const value &v, bool is_key)
+            {
+                core::value map_;
+
+                if ((v.is_array() && v.array_size() > column_names.array_size())
+                        || column_names.array_size() == 0) // Not enough column names to cover all attributes!!
+                    throw core::error("cppdatalib::core::table_to_array_of_maps_filter - not enough column names provided for specified data");
+
+                if (v.is_array())
+                    for (size_t i = 0; i < column_names.array_size(); ++i)
+                    {
+                        if (i >= v.size() && fail_on_missing_column)
+                            throw core::error("cppdatalib::core::table_to_array_of_maps_filter - missing column entry in table row");
+                        map_.add_member(column_names[i], i < v.size()? v[i]: core::value(core::null_t()));
+                    }
+                else
+                    map_.add_member(column_names.element(0), v);
+
+                buffer_filter::write_buffered_value_(map_, is_key);
+            }
+        };
+
+        // Outputs only the values at the specified JSON pointers (e.g. "/data/items/*/price", where "*" matches any array element, or a member named "*"), without building the input.
+        // The pointers are relative to each top-level value. All matching values are written, in order, as elements of a single array.
+        // If a matching value contains other matching values, it is only written once
+        class path_extract_filter : public impl::stream_filter_base
+        {
+            impl::pointer_automaton automaton;
+            std::vector<int> states; // State of each open container, while not within a matching value
+            size_t forwarding; // Number of open containers of the matching value being written, or 0 if no value is being written
+
+            core::string_t key;
+            bool key_valid;
+
+            // Returns the state of the next value, which is not a key
+            int next_state() const
+            {
+                if (nesting_depth() == 0)
+                    return automaton.start();
+                else if (current_container() == core::array)
+                    return automaton.index_transition(states.back(), current_container_size());
+                return key_valid? automaton.key_transition(states.back(), key): int(impl::pointer_automaton::dead);
+            }
+
+            // Returns true if the container or string starting now should be written to the output
+            bool begin_scope(bool is_key)
+            {
+                if (forwarding)
+                {
+                    ++forwarding;
+                    return true;
+                }
+
+                const int state = is_key? int(impl::pointer_automaton::dead): next_state();
+
+                key_valid = false;
+                if (automaton.accepting(state))
+                {
+                    forwarding = 1;
+                    return true;
+                }
+
+                states.push_back(state);
+                return false;
+            }
+
+            // Returns true if the container or string ending now should be written to the output
+            bool end_scope()
+            {
+                key_valid = false;
+                if (forwarding)
+                {
+                    --forwarding;
+                    return true;
+                }
+
+                states.pop_back();
+                return false;
+            }
+
         public:
-            array_sort_filter(core::stream_handler &output, size_t nesting_level = 0)
-                : core::buffer_filter(output, buffer_arrays, nesting_level)
-            {}
+            path_extract_filter(core::stream_handler &output, const std::vector<std::string> &paths)
+                : stream_filter_base(output)
+                , forwarding(0)
+                , key_valid(false)
+            {
+                if (!automaton.compile(paths))
+                    throw core::error("cppdatalib::core::path_extract_filter - invalid path");
+            }
 
         protected:
-            void write_buffered_value_(const value &v, bool is_key)
+            void begin_()
             {
-                using namespace std;
+                stream_filter_base::begin_();
+                output.begin_array(core::array_t(), stream_handler::unknown_size);
+                states.clear();
+                forwarding = 0;
+                key_valid = false;
+            }
+            void end_()
+            {
+                output.end_array(core::array_t());
+                stream_filter_base::end_();
+            }
 
-                if (v.get_type() == core::array)
+            bool skip_requested_() const
+            {
+                if (forwarding)
+                    return false;
+                else if (current_container() == core::string && !is_key_)
+                    return true;
+                return states.back() == impl::pointer_automaton::dead;
+            }
+
+            bool write_(const value &v, bool is_key)
+            {
+                if (forwarding)
+                    output.write(v);
+                else if (is_key)
                 {
-                    core::value sorted = v;
+                    key_valid = v.is_string() && states.back() != impl::pointer_automaton::dead;
+                    if (key_valid)
+                        key = v.get_string_unchecked();
+                }
+                else
+                {
+                    const int state = next_state();
 
-                    if (direction == ascending_sort)
-                        sort(sorted.get_array_ref().data().begin(), sorted.get_array_ref().data().end());
-                    else
-						sort(sorted.get_array_ref().data().begin(), sorted.get_array_ref().data().end(), std::greater<cppdatalib::core::value>());
+                    if (state != impl::pointer_automaton::dead && !automaton.accepting(state) && (v.is_array() || v.is_object()))
+                        return false; // Matching values may be inside, so expand the container
 
-                    buffer_filter::write_buffered_value_(sorted, is_key);
+                    key_valid = false;
+                    if (automaton.accepting(state))
+                        output.write(v);
+                }
+
+                return true;
+            }
+
+            void begin_array_(const value &v, int_t size, bool is_key) {if (begin_scope(is_key)) output.begin_array(v, size);}
+            void end_array_(const value &v, bool) {if (end_scope()) output.end_array(v);}
+
+            void begin_object_(const value &v, int_t size, bool is_key) {if (begin_scope(is_key)) output.begin_object(v, size);}
+            void end_object_(const value &v, bool) {if (end_scope()) output.end_object(v);}
+
+            void begin_string_(const value &v, int_t size, bool is_key)
+            {
+                if (forwarding)
+                {
+                    ++forwarding;
+                    output.begin_string(v, size);
+                }
+                else if (is_key)
+                {
+                    key.clear();
+                    key_valid = states.back() != impl::pointer_automaton::dead;
                 }
                 else
-                    buffer_filter::write_buffered_value_(v, is_key);
+                {
+                    if (automaton.accepting(next_state()))
+                    {
+                        forwarding = 1;
+                        output.begin_string(v, size);
+                    }
+                    key_valid = false;
+                }
+            }
+            void string_data_(const value &v, bool is_key)
+            {
+                if (forwarding)
+                    output.append_to_string(v);
+                else if (is_key && key_valid)
+                    key += v.get_string_unchecked();
+            }
+            void end_string_(const value &v, bool)
+            {
+                if (forwarding)
+                {
+                    --forwarding;
+                    output.end_string(v);
+                }
             }
         };
 
-        class table_to_array_of_maps_filter : public core::buffer_filter
+        // Keeps only the specified fields of objects, without buffering them. The fields are given as an object, where each member is either
+        // `true` (keep the member), `false` (drop the member), or a nested specification that is applied to the member's value.
+        // A level that keeps any member (directly or through a nested specification) only keeps the listed members. Otherwise, all members but the dropped ones are kept.
+        // Specifications apply to the elements of arrays, and scalar values are always kept, so {"items": {"id": true}} reduces every record in "items" to its "id"
+        class projection_filter : public impl::stream_filter_base
         {
-            core::value column_names;
-            bool fail_on_missing_column;
+            static const int keep = -1; // The value is written unchanged
+            static const int drop = -2; // The value is discarded
+
+            struct node
+            {
+                node() : exclude(true) {}
+
+                std::unordered_map<core::string_t, int> fields; // The action for each listed member
+                bool exclude; // If true, unlisted members are kept, otherwise they are dropped
+            };
+
+            std::vector<node> nodes;
+            std::vector<int> frames; // Node applied to each open container, while the container is being projected
+            size_t passing; // Number of open containers and strings being written unchanged
+            size_t skipping; // Number of open containers and strings being discarded
+
+            core::string_t key;
+            int member_action; // Action for the value of the current object member
+
+            // Compiles `spec`, returning the index of its node
+            int compile(const core::value &spec)
+            {
+                const int id = static_cast<int>(nodes.size());
+
+                if (!spec.is_object())
+                    throw core::error("cppdatalib::core::projection_filter - field specification must be an object");
+
+                nodes.push_back(node());
+                for (const auto &member: spec.get_object_unchecked())
+                {
+                    int action;
+
+                    if (!member.first.is_string())
+                        throw core::error("cppdatalib::core::projection_filter - field names must be strings");
+                    else if (member.second.is_bool())
+                        action = member.second.get_bool_unchecked()? keep: drop;
+                    else
+                        action = compile(member.second);
+
+                    if (action == keep || (action >= 0 && !nodes[action].exclude))
+                        nodes[id].exclude = false;
+                    nodes[id].fields[member.first.get_string_unchecked()] = action;
+                }
+
+                return id;
+            }
+
+            // Returns the action for a member with key `name` of an object projected by node `n`
+            int member(int n, const core::string_t &name) const
+            {
+                auto it = nodes[n].fields.find(name);
+                if (it != nodes[n].fields.end())
+                    return it->second;
+                return nodes[n].exclude? keep: drop;
+            }
+
+            // Returns the action for the next value, which is not a key
+            int next_action() const
+            {
+                if (nesting_depth() == 0)
+                    return 0;
+                else if (current_container() == core::array)
+                    return frames.back();
+                return member_action;
+            }
+
+            // Returns the action for a container or string starting now, and updates the scope counters. Returns `drop` if nothing should be written
+            int begin_scope(bool is_key)
+            {
+                if (passing)
+                    return ++passing, keep;
+                else if (skipping)
+                    return ++skipping, drop;
+
+                int action;
+                if (is_key) // A complex key cannot be listed in the specification
+                    action = member_action = nodes[frames.back()].exclude? keep: drop;
+                else
+                    action = next_action();
+
+                if (action == keep)
+                    passing = 1;
+                else if (action == drop)
+                    skipping = 1;
+                return action;
+            }
+
+            // Returns the action for a container or string ending now, and updates the scope counters
+            int end_scope()
+            {
+                if (passing)
+                    return --passing, keep;
+                else if (skipping)
+                    return --skipping, drop;
+
+                frames.pop_back();
+                return 0;
+            }
 
         public:
-            table_to_array_of_maps_filter(core::stream_handler &output, const core::value &column_names, bool fail_on_missing_column = false)
-                : core::buffer_filter(output, buffer_arrays, 1)
-                , column_names(column_names)
-                , fail_on_missing_column(fail_on_missing_column)
-            {}
+            projection_filter(core::stream_handler &output, const core::value &fields)
+                : stream_filter_base(output)
+                , passing(0)
+                , skipping(0)
+                , member_action(drop)
+            {
+                compile(fields);
+            }
 
         protected:
-            void write_buffered_value_(const value &v, bool is_key)
+            void begin_()
             {
-                core::value map_;
+                stream_filter_base::begin_();
+                frames.clear();
+                passing = skipping = 0;
+            }
 
-                if ((v.is_array() && v.array_size() > column_names.array_size())
-                        || column_names.array_size() == 0) // Not enough column names to cover all attributes!!
-                    throw core::error("cppdatalib::core::table_to_array_of_maps_filter - not enough column names provided for specified data");
+            bool skip_requested_() const {return skipping > 0;}
 
-                if (v.is_array())
-                    for (size_t i = 0; i < column_names.array_size(); ++i)
-                    {
-                        if (i >= v.size() && fail_on_missing_column)
-                            throw core::error("cppdatalib::core::table_to_array_of_maps_filter - missing column entry in table row");
-                        map_.add_member(column_names[i], i < v.size()? v[i]: core::value(core::null_t()));
-                    }
+            bool write_(const value &v, bool is_key)
+            {
+                if (passing)
+                    output.write(v);
+                else if (skipping)
+                    ;
+                else if (is_key)
+                {
+                    member_action = v.is_string()? member(frames.back(), v.get_string_unchecked()): nodes[frames.back()].exclude? keep: drop;
+                    if (member_action != drop)
+                        output.write(v);
+                }
                 else
-                    map_.add_member(column_names.element(0), v);
+                {
+                    const int action = next_action();
 
-                buffer_filter::write_buffered_value_(map_, is_key);
+                    if (action >= 0 && (v.is_array() || v.is_object()))
+                        return false; // Project the container's contents
+                    else if (action != drop)
+                        output.write(v);
+                }
+
+                return true;
+            }
+
+            void begin_array_(const value &v, int_t size, bool is_key)
+            {
+                const int action = begin_scope(is_key);
+
+                if (action >= 0)
+                {
+                    frames.push_back(action);
+                    output.begin_array(core::value(core::array_t(), v.get_subtype()), size);
+                }
+                else if (action == keep)
+                    output.begin_array(v, size);
+            }
+            void end_array_(const value &v, bool)
+            {
+                if (end_scope() != drop)
+                    output.end_array(v);
+            }
+
+            void begin_object_(const value &v, int_t size, bool is_key)
+            {
+                const int action = begin_scope(is_key);
+
+                if (action >= 0)
+                {
+                    frames.push_back(action);
+                    output.begin_object(core::value(core::object_t(), v.get_subtype()), stream_handler::unknown_size);
+                }
+                else if (action == keep)
+                    output.begin_object(v, size);
+            }
+            void end_object_(const value &v, bool)
+            {
+                if (end_scope() != drop)
+                    output.end_object(v);
+            }
+
+            void begin_string_(const value &v, int_t size, bool is_key)
+            {
+                if (passing || skipping || !is_key)
+                {
+                    const int action = begin_scope(false);
+
+                    if (action >= 0) // Projections do not apply to strings
+                        passing = 1;
+                    if (action != drop)
+                        output.begin_string(v, size);
+                }
+                else
+                    key.clear();
+            }
+            void string_data_(const value &v, bool is_key)
+            {
+                if (passing)
+                    output.append_to_string(v);
+                else if (!skipping && is_key)
+                    key += v.get_string_unchecked();
+            }
+            void end_string_(const value &v, bool is_key)
+            {
+                if (passing || skipping || !is_key)
+                {
+                    if (end_scope() != drop)
+                        output.end_string(v);
+                }
+                else
+                {
+                    member_action = member(frames.back(), key);
+                    if (member_action != drop)
+                        output.write(core::value(key, v.get_subtype()));
+                }
             }
         };
 
         class duplicate_key_check_filter : public impl::stream_filter_base
         {
+            // The keys of one object. String keys are kept in an open-addressing hash table of views into a single
+            // character buffer, so they can be checked without building a value. Other keys are built into values
             class layer
             {
-                void operator=(const layer &) {}
+                struct slot
+                {
+                    size_t offset; // Offset of key in `strings`
+                    size_t length; // Length of key, or -1 if this slot is empty
+                    uint64_t hash;
+                    core::subtype_t subtype;
+                };
+
+                struct complex_keys
+                {
+                    complex_keys() : key_builder(key) {}
+
+                    value key;
+                    value_builder key_builder;
+                    std::unordered_set<core::value> keys;
+                };
+
+                std::string strings;
+                std::vector<slot> slots;
+                size_t used;
+
+                size_t pending_offset; // Offset in `strings` of the string key currently being parsed
+                core::subtype_t pending_subtype;
+
+                std::unique_ptr<complex_keys> complex; // Allocated the first time a non-string key is found
+
+                static uint64_t hash_string(const char *data, size_t length, core::subtype_t subtype)
+                {
+                    return core::impl::hash_bytes(data, length, static_cast<uint16_t>(subtype));
+                }
+
+                // Returns the slot for the specified key, either the slot containing it or the empty slot it belongs in
+                slot &find(const char *data, size_t length, uint64_t hash, core::subtype_t subtype)
+                {
+                    const size_t mask = slots.size() - 1;
+
+                    for (size_t idx = static_cast<size_t>(hash) & mask; ; idx = (idx + 1) & mask)
+                    {
+                        slot &s = slots[idx];
+
+                        if (s.length == size_t(-1) ||
+                                (s.hash == hash && s.length == length && s.subtype == subtype &&
+                                 memcmp(strings.data() + s.offset, data, length) == 0))
+                            return s;
+                    }
+                }
+
+                void grow()
+                {
+                    std::vector<slot> old(std::max(size_t(16), slots.size() * 2), slot{0, size_t(-1), 0, 0});
+
+                    old.swap(slots);
+                    for (const auto &s: old)
+                        if (s.length != size_t(-1))
+                            find(strings.data() + s.offset, s.length, s.hash, s.subtype) = s;
+                }
+
+                // Adds the string key stored in `strings`, starting at `offset`
+                // Throws an error if the key was already present
+                void insert(size_t offset, core::subtype_t subtype)
+                {
+                    const char *data = strings.data() + offset;
+                    const size_t length = strings.size() - offset;
+                    const uint64_t hash = hash_string(data, length, subtype);
+
+                    if ((used + 1) * 4 > slots.size() * 3)
+                        grow();
+
+                    slot &s = find(data, length, hash, subtype);
+                    if (s.length != size_t(-1))
+                    {
+                        strings.resize(offset);
+                        throw core::error("cppdatalib::core::duplicate_key_check_filter - invalid duplicate object key found");
+                    }
+
+                    s = slot{offset, length, hash, subtype};
+                    ++used;
+                }
+
+                void insert_complex(const core::value &key)
+                {
+                    if (!complex->keys.insert(key).second)
+                        throw core::error("cppdatalib::core::duplicate_key_check_filter - invalid duplicate object key found");
+                }
 
             public:
-                layer() : key_builder(key) {}
-                // WARNING: layers should NOT be copied while key_builder.active() is true!!!
-                // This will corrupt the internal state, since value_builders cannot be copied!
-                // The following constructors are SOLELY for interoperability with the STL, when the layer is inactive
-                layer(const layer &other)
-                    : key(other.key)
-                    , key_builder(key)
-                    , keys(other.keys)
-                {}
-                layer(layer &&other)
-                    : key(std::move(other.key))
-                    , key_builder(key)
-                    , keys(std::move(other.keys))
-                {}
+                layer() : used(0), pending_offset(0), pending_subtype(core::normal) {}
+
+                void clear()
+                {
+                    strings.clear();
+                    if (slots.size() > 64 && used * 8 < slots.size()) // Don't keep a huge table around for small objects
+                        slots.clear();
+                    else if (used)
+                        std::fill(slots.begin(), slots.end(), slot{0, size_t(-1), 0, 0});
+                    used = 0;
+
+                    if (complex)
+                        complex->keys.clear();
+                }
+
+                // String keys that are provided all at once
+                void add_string_key(const core::value &key)
+                {
+                    pending_offset = strings.size();
+                    strings += key.get_string_unchecked();
+                    insert(pending_offset, key.get_subtype());
+                }
 
-                void begin() {key_builder.begin();}
-                void end() {key_builder.end();}
+                // String keys that are provided in pieces
+                void begin_string_key(const core::value &key) {pending_offset = strings.size(); pending_subtype = key.get_subtype();}
+                void append_to_string_key(const core::value &data) {strings += data.get_string_unchecked();}
+                void end_string_key() {insert(pending_offset, pending_subtype);}
+
+                // Non-string, non-container keys
+                void add_scalar_key(const core::value &key)
+                {
+                    if (!complex)
+                        complex.reset(new complex_keys());
+
+                    insert_complex(key);
+                }
+
+                // Container keys. The key's events must be written to `get_complex_key_builder()` until `end_complex_key()` is called
+                void begin_complex_key()
+                {
+                    if (!complex)
+                        complex.reset(new complex_keys());
+
+                    complex->key_builder.begin();
+                }
+                void end_complex_key()
+                {
+                    complex->key_builder.end();
+                    insert_complex(complex->key);
+                }
 
-                value key;
-                value_builder key_builder;
-                std::set<core::value> keys;
+                bool building_complex_key() const {return complex && complex->key_builder.active();}
+                core::value_builder &get_complex_key_builder() {return complex->key_builder;}
             };
 
-            // WARNING: Underlying container type of `layer`s MUST not copy stored layers when adding to it,
-            // so the value_builders in the layer don't get corrupted (i.e. DON'T USE A VECTOR)
-            std::list<layer> layers;
+            // Layers are reused when objects end, so their memory can be recycled for following objects.
+            // Only the first `depth` layers are in use
+            std::vector<layer> layers;
+            size_t depth;
+            size_t complex_keys_active; // Number of layers currently building a container key
+
+            template<typename F>
+            void for_each_complex_key(F f)
+            {
+                if (complex_keys_active)
+                    for (size_t i = 0; i < depth; ++i)
+                        if (layers[i].building_complex_key())
+                            f(layers[i].get_complex_key_builder());
+            }
 
         public:
-            duplicate_key_check_filter(core::stream_handler &output) : stream_filter_base(output) {}
+            duplicate_key_check_filter(core::stream_handler &output)
+                : stream_filter_base(output)
+                , depth(0)
+                , complex_keys_active(0)
+            {}
 
         protected:
-            void begin_() {stream_filter_base::begin_(); layers.clear();}
+            void begin_()
+            {
+                stream_filter_base::begin_();
+                depth = 0;
+                complex_keys_active = 0;
+            }
 
-            void begin_key_(const value &) {layers.back().begin();}
-            void end_key_(const value &)
+            bool write_(const value &v, bool is_key)
             {
-                layers.back().end();
+                if (v.is_array() || v.is_object())
+                    return false; // Expand containers so any objects inside are checked
 
-                // Check against already parsed keys for current object, if it exists, throw an error
-                if (layers.back().keys.find(layers.back().key) != layers.back().keys.end())
-                    throw core::error("cppdatalib::core::duplicate_key_check_filter - invalid duplicate object key found");
-                else
-                    layers.back().keys.insert(layers.back().key);
+                if (is_key)
+                {
+                    if (v.is_string())
+                        layers[depth-1].add_string_key(v);
+                    else
+                        layers[depth-1].add_scalar_key(v);
+                }
+
+                output.write(v);
+                for_each_complex_key([&v](core::value_builder &b) {b.write(v);});
+                return true;
             }
 
-            void begin_scalar_(const value &v, bool)
+            void begin_key_(const value &v)
             {
-                output.write(v);
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.write(v);
+                if (!v.is_string())
+                {
+                    layers[depth-1].begin_complex_key();
+                    ++complex_keys_active;
+                }
+            }
+            void end_key_(const value &v)
+            {
+                if (!v.is_string())
+                {
+                    --complex_keys_active;
+                    layers[depth-1].end_complex_key();
+                }
             }
 
             void begin_array_(const value &v, int_t size, bool)
             {
                 output.begin_array(v, size);
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.begin_array(v, size);
+                for_each_complex_key([&v, size](core::value_builder &b) {b.begin_array(v, size);});
             }
             void end_array_(const value &v, bool)
             {
                 output.end_array(v);
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.end_array(v);
+                for_each_complex_key([&v](core::value_builder &b) {b.end_array(v);});
             }
 
             void begin_object_(const value &v, int_t size, bool)
             {
                 output.begin_object(v, size);
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.begin_object(v, size);
-                layers.push_back(layer());
+                for_each_complex_key([&v, size](core::value_builder &b) {b.begin_object(v, size);});
+
+                if (depth == layers.size())
+                    layers.push_back(layer());
+                layers[depth++].clear();
             }
             void end_object_(const value &v, bool)
             {
                 output.end_object(v);
-                layers.pop_back();
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.end_object(v);
+                --depth;
+                for_each_complex_key([&v](core::value_builder &b) {b.end_object(v);});
             }
 
-            void begin_string_(const value &v, int_t size, bool)
+            void begin_string_(const value &v, int_t size, bool is_key)
             {
                 output.begin_string(v, size);
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.begin_string(v, size);
+                for_each_complex_key([&v, size](core::value_builder &b) {b.begin_string(v, size);});
+                if (is_key)
+                    layers[depth-1].begin_string_key(v);
             }
-            void string_data_(const value &v, bool)
+            void string_data_(const value &v, bool is_key)
             {
                 output.append_to_string(v);
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.append_to_string(v);
+                for_each_complex_key([&v](core::value_builder &b) {b.append_to_string(v);});
+                if (is_key)
+                    layers[depth-1].append_to_string_key(v);
             }
-            void end_string_(const value &v, bool)
+            void end_string_(const value &v, bool is_key)
             {
                 output.end_string(v);
-                for (auto i = layers.begin(); i != layers.end(); ++i)
-                    if (i->key_builder.active())
-                        i->key_builder.end_string(v);
+                for_each_complex_key([&v](core::value_builder &b) {b.end_string(v);});
+                if (is_key)
+                    layers[depth-1].end_string_key();
             }
         };
 
@@ -170,6 +170,7 @@ namespace cppdatalib
         public:
             struct traversal_reference;
             struct traversal_ancestry_finder;
+            class traversal_path_builder;
 
         private:
             // Functors should return true if processing should continue
@@ -192,9 +193,12 @@ namespace cppdatalib
             static value &assign(value &dst, const value &src);
 
         public:
+            // A read-only view of the containers enclosing the value currently being traversed. Nothing is copied when the view is created or accessed
             struct traversal_ancestry_finder
             {
                 typedef std::stack<traversal_reference, std::vector<traversal_reference>> container;
+                typedef container::container_type::const_iterator const_iterator;
+                typedef container::container_type::const_reverse_iterator const_reverse_iterator;
 
                 const container &c;
 
@@ -203,20 +207,25 @@ namespace cppdatalib
 
                 size_t get_parent_count() const {return c.size();}
 
-                // First element is direct parent, last element is ancestry root
-                std::vector<traversal_reference> get_ancestry() const
-                {
-                    std::vector<traversal_reference> result;
-                    container temp = c;
+                // Returns the number of containers enclosing the current value
+                size_t depth() const {return c.size();}
 
-                    while (!temp.empty())
-                    {
-                        result.push_back(temp.top());
-                        temp.pop();
-                    }
+                // Returns the `idx`th enclosing container, where 0 is the direct parent and depth() - 1 is the ancestry root
+                const traversal_reference &parent(size_t idx = 0) const;
 
-                    return result;
-                }
+                // Iterate over the enclosing containers from the ancestry root to the direct parent
+                const_iterator begin() const;
+                const_iterator end() const;
+
+                // Iterate over the enclosing containers from the direct parent to the ancestry root
+                const_reverse_iterator rbegin() const;
+                const_reverse_iterator rend() const;
+
+                // First element is direct parent, last element is ancestry root
+                std::vector<traversal_reference> get_ancestry() const {return std::vector<traversal_reference>(rbegin(), rend());}
+
+            private:
+                const container::container_type &references() const;
             };
 
             // Predicates must be callables with argument type `const core::value *arg, core::value::traversal_ancestry_finder arg_finder` and return value bool
@@ -381,6 +390,11 @@ namespace cppdatalib
             void set_subtype(subtype_t _type) {subtype_ = _type;}
 
             type get_type() const {return type_;}
+
+            // Returns a 64-bit structural hash of this value, including all nested values. Values that compare equal have equal hashes.
+            // The hash is computed without recursion, and is not stable across platforms or library versions
+            uint64_t hash() const;
+
             size_t size() const;
             size_t array_size() const;
             size_t object_size() const;
@@ -949,12 +963,13 @@ namespace cppdatalib
 
         struct value::traversal_reference
         {
-            traversal_reference(const value *p, array_const_iterator_t a, object_const_iterator_t o, bool traversed_key, bool frozen = false)
+            traversal_reference(const value *p, array_const_iterator_t a, object_const_iterator_t o, bool traversed_key, bool frozen = false, bool values_only = false)
                 : p(p)
                 , array(a)
                 , object(o)
                 , traversed_key_already(traversed_key)
                 , frozen(frozen)
+                , values_only(values_only)
             {}
 
             bool is_array() const {return p && p->is_array() && array != array_const_iterator_t() && array != p->get_array_unchecked().end();}
@@ -966,6 +981,15 @@ namespace cppdatalib
             const core::value *get_object_key() const {return is_object()? std::addressof(object->first): NULL;}
             const core::value *get_object_value() const {return is_object()? std::addressof(object->second): NULL;}
 
+            // The following functions describe the child of this container that is currently being traversed,
+            // and are valid while the traversal functions of `value` (except parallel_diff_traverse()) invoke a predicate
+
+            const core::value *get_container() const {return p;}
+            // Returns the index of the array element being traversed
+            size_t get_current_array_index() const {return array.data() - p->get_array_unchecked().begin().data() - 1;}
+            // Returns the key of the object member being traversed (either its key or its value may be the current value)
+            const core::value *get_current_object_key() const {return std::addressof((traversed_key_already && !values_only? object.data(): std::prev(object.data()))->first);}
+
         private:
             friend class value;
             friend class value_parser;
@@ -975,6 +999,101 @@ namespace cppdatalib
             object_const_iterator_t object;
             bool traversed_key_already;
             bool frozen;
+            bool values_only; // True if only the values of object members are traversed, so the iterator is always past the current member
+        };
+
+        inline const value::traversal_ancestry_finder::container::container_type &value::traversal_ancestry_finder::references() const
+        {
+            // std::stack does not expose its container, except to derived classes
+            struct access : container
+            {
+                static const container_type &get(const container &stack) {return stack.*&access::c;}
+            };
+
+            return access::get(c);
+        }
+
+        inline const value::traversal_reference &value::traversal_ancestry_finder::parent(size_t idx) const {return references()[references().size() - idx - 1];}
+        inline value::traversal_ancestry_finder::const_iterator value::traversal_ancestry_finder::begin() const {return references().begin();}
+        inline value::traversal_ancestry_finder::const_iterator value::traversal_ancestry_finder::end() const {return references().end();}
+        inline value::traversal_ancestry_finder::const_reverse_iterator value::traversal_ancestry_finder::rbegin() const {return references().rbegin();}
+        inline value::traversal_ancestry_finder::const_reverse_iterator value::traversal_ancestry_finder::rend() const {return references().rend();}
+
+        // Builds the JSON Pointer path of the value currently being traversed. Consecutive calls during one traversal
+        // only rebuild the path segments that changed, so building the path of every node in a traversal takes linear time
+        class value::traversal_path_builder
+        {
+            struct segment
+            {
+                const value *container; // Container the segment refers into
+                const value *child; // Element or member key of `container` the segment refers to
+                size_t end; // Length of the path up to and including this segment
+            };
+
+            std::vector<segment> segments;
+            std::string path_;
+
+            static const value *current_child(const traversal_reference &ref)
+            {
+                if (ref.get_container()->is_array())
+                    return std::addressof(ref.get_container()->get_array_unchecked().data()[ref.get_current_array_index()]);
+                return ref.get_current_object_key();
+            }
+
+            void append(const traversal_reference &ref)
+            {
+                path_.push_back('/');
+                if (ref.get_container()->is_array())
+                    path_ += std::to_string(ref.get_current_array_index());
+                else
+                {
+                    const value *key = ref.get_current_object_key();
+                    if (!key->is_string())
+                        throw core::error("cppdatalib::core::value::traversal_path_builder - path contains key that is not a string");
+
+                    for (auto c: key->get_string_unchecked())
+                    {
+                        if (c == '~')
+                            path_ += "~0";
+                        else if (c == '/')
+                            path_ += "~1";
+                        else
+                            path_.push_back(c);
+                    }
+                }
+            }
+
+        public:
+            // Returns the path of the value being traversed, given the ancestry passed to the traversal predicate
+            const std::string &path(traversal_ancestry_finder finder)
+            {
+                // A container only appears at one depth, with the same ancestors, so the first segment from the end that is
+                // still current shows that all segments before it are still current as well
+                size_t valid = std::min(segments.size(), finder.depth());
+                while (valid > 0)
+                {
+                    const traversal_reference &ref = *(finder.begin() + (valid - 1));
+                    if (segments[valid - 1].container == ref.get_container() && segments[valid - 1].child == current_child(ref))
+                        break;
+                    --valid;
+                }
+
+                segments.resize(valid);
+                path_.resize(valid? segments.back().end: 0);
+
+                for (auto it = finder.begin() + valid; it != finder.end(); ++it)
+                {
+                    append(*it);
+                    segments.push_back(segment{it->get_container(), current_child(*it), path_.size()});
+                }
+
+                return path_;
+            }
+
+            // Returns the most recently built path
+            const std::string &get_path() const {return path_;}
+
+            void clear() {segments.clear(); path_.clear();}
         };
 
         // Predicates must be callables with argument type `const core::value *arg, core::value::traversal_ancestry_finder arg_finder` and return value bool
@@ -1126,7 +1245,7 @@ namespace cppdatalib
                     }
                     else if (p->is_object())
                     {
-                        references.push(traversal_reference(p, array_const_iterator_t(), p->get_object_unchecked().begin(), true));
+                        references.push(traversal_reference(p, array_const_iterator_t(), p->get_object_unchecked().begin(), true, false, true));
                         if (!p->get_object_unchecked().empty())
                             p = std::addressof((references.top().object++)->second);
                         else
@@ -1182,7 +1301,7 @@ namespace cppdatalib
                     }
                     else if (p->is_object())
                     {
-                        references.push(traversal_reference(p, array_const_iterator_t(), p->get_object_unchecked().begin(), true));
+                        references.push(traversal_reference(p, array_const_iterator_t(), p->get_object_unchecked().begin(), true, false, true));
                         if (!p->get_object_unchecked().empty())
                             p = std::addressof((references.top().object++)->second);
                         else
@@ -1780,11 +1899,153 @@ namespace cppdatalib
         {
             return value(bind, userdata, subtype);
         }
+
+        namespace impl
+        {
+            // 64x64->128-bit multiply, folded to 64 bits
+            inline uint64_t hash_mum(uint64_t a, uint64_t b)
+            {
+#ifdef __SIZEOF_INT128__
+                const __uint128_t r = static_cast<__uint128_t>(a) * b;
+                return static_cast<uint64_t>(r) ^ static_cast<uint64_t>(r >> 64);
+#else
+                const uint64_t a_lo = a & 0xffffffffu, a_hi = a >> 32;
+                const uint64_t b_lo = b & 0xffffffffu, b_hi = b >> 32;
+                const uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+                const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffffu) + lo_hi;
+                const uint64_t lo = (cross << 32) | (lo_lo & 0xffffffffu);
+                const uint64_t hi = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+                return lo ^ hi;
+#endif
+            }
+
+            inline uint64_t hash_read64(const unsigned char *p) {uint64_t v; memcpy(&v, p, 8); return v;}
+            inline uint64_t hash_read32(const unsigned char *p) {uint32_t v; memcpy(&v, p, 4); return v;}
+
+            static const uint64_t hash_secret[4] = {0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull};
+
+            // Mixes `value` into the running hash `h`
+            inline uint64_t hash_combine(uint64_t h, uint64_t value)
+            {
+                return hash_mum(h ^ hash_secret[0], value ^ hash_secret[1]);
+            }
+
+            // Final avalanche step, so that every bit of the result depends on every bit of the input
+            inline uint64_t hash_finish(uint64_t h)
+            {
+                return hash_mum(h ^ hash_secret[2], hash_secret[3]);
+            }
+
+            // Hashes a run of bytes (wyhash-style: 16 bytes are consumed per multiply)
+            inline uint64_t hash_bytes(const char *data, size_t size, uint64_t seed = 0)
+            {
+                const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+                uint64_t a, b;
+
+                seed ^= hash_mum(seed ^ hash_secret[0], hash_secret[1]);
+
+                if (size <= 16)
+                {
+                    if (size >= 4)
+                    {
+                        a = (hash_read32(p) << 32) | hash_read32(p + ((size >> 3) << 2));
+                        b = (hash_read32(p + size - 4) << 32) | hash_read32(p + size - 4 - ((size >> 3) << 2));
+                    }
+                    else if (size > 0)
+                    {
+                        a = (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) | p[size - 1];
+                        b = 0;
+                    }
+                    else
+                        a = b = 0;
+                }
+                else
+                {
+                    size_t remaining = size;
+
+                    while (remaining > 16)
+                    {
+                        seed = hash_mum(hash_read64(p) ^ hash_secret[1], hash_read64(p + 8) ^ seed);
+                        p += 16;
+                        remaining -= 16;
+                    }
+
+                    a = hash_read64(p + remaining - 16);
+                    b = hash_read64(p + remaining - 8);
+                }
+
+                return hash_mum(hash_secret[1] ^ size, hash_mum(a ^ hash_secret[1], b ^ seed));
+            }
+
+            // Hashes one node of a value. Containers contribute their type, subtype, and size; their elements are hashed separately
+            inline uint64_t hash_node(uint64_t h, const value &v)
+            {
+                h = hash_combine(h, (uint64_t(uint8_t(v.get_type())) << 32) | uint16_t(v.get_subtype()));
+
+                switch (v.get_type())
+                {
+                    case boolean: return hash_combine(h, v.get_bool_unchecked());
+                    case integer: return hash_combine(h, static_cast<uint64_t>(v.get_int_unchecked()));
+                    case uinteger: return hash_combine(h, static_cast<uint64_t>(v.get_uint_unchecked()));
+                    case real:
+                    {
+                        double d = static_cast<double>(v.get_real_unchecked());
+                        uint64_t bits;
+
+                        if (d == 0)
+                            d = 0; // Positive and negative zero compare equal
+                        else if (std::isnan(d))
+                            d = NAN;
+
+                        memcpy(&bits, &d, sizeof(bits));
+                        return hash_combine(h, bits);
+                    }
+                    case string: return hash_combine(h, hash_bytes(v.get_string_unchecked().data(), v.get_string_unchecked().size()));
+                    case array:
+                    case object: return hash_combine(h, v.size());
+                    case null:
+                    default: return h;
+                }
+            }
+
+            struct traverse_node_hash
+            {
+                uint64_t h;
+
+                traverse_node_hash() : h(0) {}
+
+                bool operator()(const value *arg, value::traversal_ancestry_finder, bool prefix)
+                {
+                    if (prefix)
+                        h = hash_node(h, *arg);
+                    return true;
+                }
+            };
+        }
+
+        inline uint64_t value::hash() const
+        {
+            if (!is_array() && !is_object())
+                return impl::hash_finish(impl::hash_node(0, *this));
+
+            impl::traverse_node_hash hasher;
+            traverse(hasher);
+            return impl::hash_finish(hasher.h);
+        }
     }
 
     void swap(core::value &l, core::value &r) {l.swap(r);}
 }
 
+namespace std
+{
+    template<>
+    struct hash<cppdatalib::core::value>
+    {
+        size_t operator()(const cppdatalib::core::value &v) const {return static_cast<size_t>(v.hash());}
+    };
+}
+
 template<typename T>
 class cast_to_cppdatalib
 {
@@ -101,6 +101,23 @@ namespace cppdatalib
                     *references.top() = v;
             }
 
+            // write_array_of_() appends all the elements to the array being built at once
+            bool write_array_of_(const int64_t *data, size_t size) {return append_elements<core::int_t>(data, size);}
+            bool write_array_of_(const uint64_t *data, size_t size) {return append_elements<core::uint_t>(data, size);}
+            bool write_array_of_(const double *data, size_t size) {return append_elements<core::real_t>(data, size);}
+            bool write_array_of_(const float *data, size_t size) {return append_elements<core::real_t>(data, size);}
+
+            template<typename Element, typename T>
+            bool append_elements(const T *data, size_t size)
+            {
+                core::array_t::container_type &elements = references.top()->get_array_ref().data();
+
+                for (size_t i = 0; i < size; ++i)
+                    elements.push_back(core::value(static_cast<Element>(data[i])));
+
+                return true;
+            }
+
             void string_data_(const core::value &v, bool)
             {
                 if (references.empty())
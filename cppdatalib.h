@@ -28,6 +28,7 @@
 #include "core/core.h"
 #include "json/json_pointer.h"
 #include "json/json_patch.h"
+#include "json/json_merge_patch.h"
 #include "json/json.h"
 #include "bencode/bencode.h"
 #include "bjson/bjson.h"
@@ -36,12 +37,18 @@
 #include "rpc/xml.h"
 #include "csv/csv.h"
 #include "binn/binn.h"
+#include "binn/binn_view.h"
 #include "ubjson/ubjson.h"
 #include "xls/xml.h"
 #include "netstrings/netstrings.h"
 #include "message_pack/message_pack.h"
 #include "mysql/mysql.h"
 
+#ifdef CPPDATALIB_ENABLE_THREADS
+#include "core/parallel.h"
+#include "core/channel.h"
+#endif
+
 #ifdef CPPDATALIB_ENABLE_BOOST_COMPUTE
 #include "adapters/boost_compute.h"
 #endif
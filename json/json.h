@@ -47,6 +47,13 @@ namespace cppdatalib
                 char *write = buffer.get();
 
                 writer.begin_string(core::string_t(), core::stream_handler::unknown_size);
+                if (writer.skip_requested())
+                {
+                    skip_string(stream);
+                    writer.end_string(core::string_t());
+                    return stream;
+                }
+
                 while (c = stream.get(), c != '"' && c != EOF)
                 {
                     if (c == '\\')
@@ -113,6 +120,46 @@ namespace cppdatalib
                 return stream;
             }
 
+            // Opening quote should already be read. The string is not unescaped or validated
+            void skip_string(core::istream &stream)
+            {
+                int c;
+
+                while (c = stream.get(), c != '"' && c != EOF)
+                    if (c == '\\' && stream.get() == EOF)
+                        break;
+
+                if (c == EOF)
+                    throw core::error("JSON - unexpected end of string");
+            }
+
+            // Opening bracket should already be read. Skips the contents of the array or object, up to and including the closing bracket
+            // Only strings and the nesting of brackets are checked, the skipped values are not validated
+            void skip_current_value(core::istream &stream, char close)
+            {
+                std::vector<char> closing(1, close);
+                int c;
+
+                while (!closing.empty())
+                {
+                    c = stream.get();
+                    switch (c)
+                    {
+                        case EOF: throw core::error("JSON - unexpected end of stream");
+                        case '"': skip_string(stream); break;
+                        case '[': closing.push_back(']'); break;
+                        case '{': closing.push_back('}'); break;
+                        case ']':
+                        case '}':
+                            if (c != closing.back())
+                                throw core::error("JSON - mismatched brackets");
+                            closing.pop_back();
+                            break;
+                        default: break;
+                    }
+                }
+            }
+
         public:
             parser(core::istream_handle input)
                 : core::stream_parser(input)
@@ -180,6 +227,13 @@ namespace cppdatalib
                         case '[':
                             get_output()->begin_array(core::array_t(), core::stream_handler::unknown_size);
                             delimiter_required = false;
+
+                            if (get_output()->skip_requested())
+                            {
+                                skip_current_value(stream(), ']');
+                                get_output()->end_array(core::array_t());
+                                delimiter_required = true;
+                            }
                             break;
                         case ']':
                             get_output()->end_array(core::array_t());
@@ -188,6 +242,13 @@ namespace cppdatalib
                         case '{':
                             get_output()->begin_object(core::object_t(), core::stream_handler::unknown_size);
                             delimiter_required = false;
+
+                            if (get_output()->skip_requested())
+                            {
+                                skip_current_value(stream(), '}');
+                                get_output()->end_object(core::object_t());
+                                delimiter_required = true;
+                            }
                             break;
                         case '}':
                             get_output()->end_object(core::object_t());
@@ -0,0 +1,401 @@
+/*
+ * json_merge_patch.h
+ *
+ * Copyright © 2017 Oliver Adams
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the “Software”), to
+ * deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef CPPDATALIB_JSON_MERGE_PATCH_H
+#define CPPDATALIB_JSON_MERGE_PATCH_H
+
+#include "../core/core.h"
+#include "../json/json_patch.h"
+
+#include <unordered_set>
+
+namespace cppdatalib
+{
+    namespace json
+    {
+        namespace merge_patch
+        {
+            namespace impl
+            {
+                // Returns true if `it` is the last of the members of `members` with its key. Patches with duplicate keys are
+                // read the way most JSON readers do, so only the last member with a key is applied
+                inline bool is_last_with_key(const core::object_t::container_type &members, core::object_t::container_type::const_iterator it)
+                {
+                    ++it;
+                    return it == members.end() || !(it->first == std::prev(it)->first);
+                }
+            }
+
+            // Applies the JSON Merge Patch (RFC 7396) `patch` to `target` in place
+            // Members of `patch` that are null are removed from `target`, objects are merged, and any other value replaces the target value.
+            // If `patch` has duplicate keys, the last member with each key is applied. If `target` has duplicate keys, only the last member
+            // with each key the patch refers to is kept
+            inline void apply(core::value &target, const core::value &patch)
+            {
+                std::vector<std::pair<core::value *, const core::value *>> stack;
+
+                stack.push_back(std::make_pair(&target, &patch));
+                while (!stack.empty())
+                {
+                    core::value *t = stack.back().first;
+                    const core::value *p = stack.back().second;
+                    stack.pop_back();
+
+                    if (!p->is_object())
+                    {
+                        *t = *p;
+                        continue;
+                    }
+
+                    core::object_t::container_type &members = t->get_object_ref().data();
+                    const core::object_t::container_type &patch_members = p->get_object_unchecked().data();
+
+                    // Every key is acted on once, so no member of `t` that is still queued on the stack is erased afterward
+                    for (auto it = patch_members.begin(); it != patch_members.end(); ++it)
+                    {
+                        if (!impl::is_last_with_key(patch_members, it))
+                            continue;
+                        else if (it->second.is_null())
+                        {
+                            members.erase(it->first);
+                            continue;
+                        }
+
+                        auto range = members.equal_range(it->first);
+                        core::value *member;
+                        if (range.first == range.second)
+                            member = &t->add_member(it->first);
+                        else
+                        {
+                            auto last = std::prev(range.second);
+                            members.erase(range.first, last);
+                            member = &last->second;
+                        }
+
+                        if (it->second.is_object())
+                            stack.push_back(std::make_pair(member, &it->second));
+                        else
+                            *member = it->second;
+                    }
+                }
+            }
+
+            // Returns the result of applying `patch` to a value that is not an object, which does not depend on the value
+            inline core::value apply_to_nothing(const core::value &patch)
+            {
+                core::value result;
+                apply(result, patch);
+                return result;
+            }
+
+            // Returns a merge patch that transforms `from` into `to`
+            // Identical subtrees are skipped by comparing structural hashes, as in json::patch::diff.
+            // Merge patches cannot set members to null, so null members in `to` are removed instead. The patch has one member per key,
+            // and duplicate keys in `from` and `to` are compared by their last member
+            inline core::value diff(const core::value &from, const core::value &to)
+            {
+                if (!from.is_object() || !to.is_object())
+                    return to;
+
+                json::patch::impl::subtree_hasher hash;
+                std::vector<std::pair<std::pair<const core::value *, const core::value *>, core::value *>> stack;
+                core::value result = core::object_t();
+
+                stack.push_back(std::make_pair(std::make_pair(&from, &to), &result));
+                while (!stack.empty())
+                {
+                    const core::object_t::container_type &f_obj = stack.back().first.first->get_object_unchecked().data();
+                    const core::object_t::container_type &t_obj = stack.back().first.second->get_object_unchecked().data();
+                    core::value &patch = *stack.back().second;
+                    stack.pop_back();
+
+                    // Only the last member with each key is compared, matching how apply() reads duplicate keys
+                    auto f = f_obj.begin(), t = t_obj.begin();
+                    while (f != f_obj.end() || t != t_obj.end())
+                    {
+                        while (f != f_obj.end() && !impl::is_last_with_key(f_obj, f))
+                            ++f;
+                        while (t != t_obj.end() && !impl::is_last_with_key(t_obj, t))
+                            ++t;
+
+                        if (f == f_obj.end() && t == t_obj.end())
+                            break;
+                        else if (t == t_obj.end() || (f != f_obj.end() && f->first < t->first))
+                            patch.add_member(f->first, core::null_t()), ++f;
+                        else if (f == f_obj.end() || t->first < f->first)
+                            patch.add_member(t->first, t->second), ++t;
+                        else
+                        {
+                            if (hash(f->second) != hash(t->second))
+                            {
+                                if (f->second.is_object() && t->second.is_object())
+                                    stack.push_back(std::make_pair(std::make_pair(&f->second, &t->second), &patch.add_member(f->first, core::object_t())));
+                                else
+                                    patch.add_member(t->first, t->second);
+                            }
+                            ++f, ++t;
+                        }
+                    }
+                }
+
+                return result;
+            }
+
+            // Applies a merge patch to each top-level value as it streams from input to output, without building the merged document.
+            // Values the patch does not refer to are passed through (or skipped, if they are removed or replaced) without being expanded.
+            // Members added by the patch are written at the end of their object. If the patch has duplicate keys, the last member with each key is applied,
+            // and if the document has duplicate keys, the patch is applied to each of their members
+            class merge_filter : public core::impl::stream_filter_base
+            {
+                enum action
+                {
+                    pass_value, // The value is written unchanged
+                    skip_value, // The value (and its key) are discarded
+                    patch_value // The value is merged with or replaced by `pending_patch`
+                };
+
+                struct frame
+                {
+                    frame(const core::value *patch) : patch(patch) {}
+
+                    const core::value *patch; // The object being merged into this object
+                    std::unordered_set<const core::value *> applied; // Members of `patch` that have been merged with a member of this object
+                };
+
+                core::value patch;
+                std::vector<frame> frames; // One frame for each object being merged
+                size_t passing; // Number of open containers and strings being written unchanged
+                size_t skipping; // Number of open containers and strings being discarded
+
+                action pending; // Action for the value of the current object member
+                const core::value *pending_patch;
+                core::string_t key;
+
+                // Returns true if no container or string is currently being passed through or skipped
+                bool merging() const {return !passing && !skipping;}
+
+                // Called when an object key is read. Finds the patch member for the key, and returns true if the key should be written
+                bool found_key(const core::value &k)
+                {
+                    frame &f = frames.back();
+                    auto range = f.patch->get_object_unchecked().data().equal_range(k);
+
+                    if (range.first == range.second)
+                    {
+                        pending = pass_value;
+                        return true;
+                    }
+
+                    const core::value *member = &std::prev(range.second)->second; // The last of duplicate keys applies
+
+                    f.applied.insert(member);
+                    pending_patch = member;
+                    pending = member->is_null()? skip_value: patch_value;
+                    return !member->is_null();
+                }
+
+                // Returns the action for the next value (not a key), and the patch to apply to it
+                action next_action(const core::value *&p) const
+                {
+                    if (nesting_depth() == 0)
+                        return p = &patch, patch_value;
+                    return p = pending_patch, pending;
+                }
+
+                // Returns true if the next value `v` is an object that the patch is merged into
+                bool merges_into(const core::value &v) const
+                {
+                    const core::value *p;
+                    return next_action(p) == patch_value && p->is_object() && v.is_object();
+                }
+
+                // Called when a value (not a key) begins. Returns the action for the value, writing the replacement value if the patch replaces it
+                action begin_value(const core::value &v)
+                {
+                    const core::value *p;
+                    const action a = next_action(p);
+
+                    pending = pass_value;
+                    if (a != patch_value)
+                        return a;
+                    else if (p->is_object() && v.is_object())
+                    {
+                        frames.push_back(frame(p));
+                        return patch_value;
+                    }
+
+                    output.write(p->is_object()? apply_to_nothing(*p): *p);
+                    return skip_value;
+                }
+
+                // Starts the scope of a container or string, and returns true if it should be written to the output
+                bool begin_scope(bool is_key)
+                {
+                    if (passing)
+                        return ++passing, true;
+                    else if (skipping)
+                        return ++skipping, false;
+                    else if (is_key) // Complex keys never match a patch member
+                        pending = pass_value;
+
+                    passing = 1;
+                    return true;
+                }
+
+            public:
+                merge_filter(core::stream_handler &output, const core::value &patch)
+                    : stream_filter_base(output)
+                    , patch(patch)
+                    , passing(0)
+                    , skipping(0)
+                    , pending(pass_value)
+                    , pending_patch(NULL)
+                {}
+
+            protected:
+                void begin_()
+                {
+                    stream_filter_base::begin_();
+                    frames.clear();
+                    passing = skipping = 0;
+                    pending = pass_value;
+                }
+
+                bool skip_requested_() const {return skipping > 0;}
+
+                bool write_(const core::value &v, bool is_key)
+                {
+                    if (passing)
+                        output.write(v);
+                    else if (skipping)
+                        ;
+                    else if (is_key)
+                    {
+                        if (found_key(v))
+                            output.write(v);
+                    }
+                    else if (merges_into(v))
+                        return false; // Merge the object's members
+                    else if (begin_value(v) == pass_value)
+                        output.write(v);
+
+                    return true;
+                }
+
+                void begin_array_(const core::value &v, core::int_t size, bool is_key)
+                {
+                    if (merging() && !is_key && begin_value(v) == skip_value)
+                        skipping = 1;
+                    else if (begin_scope(is_key))
+                        output.begin_array(v, size);
+                }
+                void end_array_(const core::value &v, bool)
+                {
+                    if (passing)
+                        --passing, output.end_array(v);
+                    else
+                        --skipping;
+                }
+
+                void begin_object_(const core::value &v, core::int_t size, bool is_key)
+                {
+                    if (merging() && !is_key)
+                    {
+                        switch (begin_value(v))
+                        {
+                            case skip_value:
+                                skipping = 1;
+                                return;
+                            case patch_value:
+                                output.begin_object(core::value(core::object_t(), v.get_subtype()), core::stream_handler::unknown_size);
+                                return;
+                            default:
+                                break;
+                        }
+                    }
+
+                    if (begin_scope(is_key))
+                        output.begin_object(v, size);
+                }
+                void end_object_(const core::value &v, bool)
+                {
+                    if (passing)
+                        --passing, output.end_object(v);
+                    else if (skipping)
+                        --skipping;
+                    else
+                    {
+                        // Members of the patch that were not in the object are added at the end
+                        const frame &f = frames.back();
+                        const core::object_t::container_type &members = f.patch->get_object_unchecked().data();
+                        for (auto it = members.begin(); it != members.end(); ++it)
+                        {
+                            if (it->second.is_null() || !impl::is_last_with_key(members, it) || f.applied.find(&it->second) != f.applied.end())
+                                continue;
+
+                            output.write(it->first);
+                            output.write(it->second.is_object()? apply_to_nothing(it->second): it->second);
+                        }
+
+                        frames.pop_back();
+                        output.end_object(v);
+                    }
+                }
+
+                void begin_string_(const core::value &v, core::int_t size, bool is_key)
+                {
+                    if (merging() && is_key)
+                        key.clear();
+                    else if (merging() && !is_key && begin_value(v) == skip_value)
+                        skipping = 1;
+                    else if (begin_scope(false))
+                        output.begin_string(v, size);
+                }
+                void string_data_(const core::value &v, bool is_key)
+                {
+                    if (passing)
+                        output.append_to_string(v);
+                    else if (!skipping && is_key)
+                        key += v.get_string_unchecked();
+                }
+                void end_string_(const core::value &v, bool is_key)
+                {
+                    if (passing)
+                        --passing, output.end_string(v);
+                    else if (skipping)
+                        --skipping;
+                    else if (is_key)
+                    {
+                        core::value k(key, v.get_subtype());
+                        if (found_key(k))
+                            output.write(k);
+                    }
+                }
+            };
+        }
+    }
+}
+
+#endif // CPPDATALIB_JSON_MERGE_PATCH_H
@@ -27,6 +27,8 @@
 
 #include "../core/core.h"
 #include "../json/json.h"
+#include "../json/json_pointer.h"
+#include <set>
 
 namespace cppdatalib
 {
@@ -34,119 +36,1178 @@ namespace cppdatalib
     {
         namespace patch
         {
-            inline core::value diff(const core::value &from, const core::value &to)
+            namespace impl
             {
-                struct traverse_diff
+                // Computes structural subtree hashes without recursion, memoizing the hash of every container visited,
+                // so that comparing any two subtrees afterward is O(1)
+                class subtree_hasher
                 {
-                    core::value diff;
+                    struct frame
+                    {
+                        frame(const core::value *v)
+                            : v(v)
+                            , h(core::impl::hash_node(0, *v))
+                            , traversed_key_already(false)
+                        {
+                            if (v->is_array())
+                                array = v->get_array_unchecked().begin();
+                            else
+                                object = v->get_object_unchecked().begin();
+                        }
+
+                        const core::value *v;
+                        uint64_t h;
+                        core::array_const_iterator_t array;
+                        core::object_const_iterator_t object;
+                        bool traversed_key_already;
+                    };
+
+                    std::unordered_map<const core::value *, uint64_t> hashes;
+                    std::vector<frame> stack;
+
+                    // Returns the next child of the container at the top of the stack, or NULL if there are no more children
+                    const core::value *next_child()
+                    {
+                        frame &f = stack.back();
+
+                        if (f.v->is_array())
+                            return f.array != f.v->get_array_unchecked().end()? std::addressof(*f.array++): NULL;
+                        else if (f.object == f.v->get_object_unchecked().end())
+                            return NULL;
+
+                        f.traversed_key_already = !f.traversed_key_already;
+                        return f.traversed_key_already? std::addressof(f.object->first): std::addressof((f.object++)->second);
+                    }
+
+                public:
+                    uint64_t operator()(const core::value &v)
+                    {
+                        if (!v.is_array() && !v.is_object())
+                            return core::impl::hash_finish(core::impl::hash_node(0, v));
+
+                        auto it = hashes.find(&v);
+                        if (it != hashes.end())
+                            return it->second;
+
+                        stack.push_back(frame(&v));
+                        while (true)
+                        {
+                            const core::value *child = next_child();
+                            uint64_t h;
+
+                            if (child == NULL)
+                            {
+                                h = core::impl::hash_finish(stack.back().h);
+                                hashes[stack.back().v] = h;
+                                stack.pop_back();
+
+                                if (stack.empty())
+                                    return h;
+                            }
+                            else if (child->is_array() || child->is_object())
+                            {
+                                it = hashes.find(child);
+                                if (it == hashes.end())
+                                {
+                                    stack.push_back(frame(child));
+                                    continue;
+                                }
+
+                                h = it->second;
+                            }
+                            else
+                                h = core::impl::hash_finish(core::impl::hash_node(0, *child));
+
+                            stack.back().h = core::impl::hash_combine(stack.back().h, h);
+                        }
+                    }
+                };
+
+                // Finds a longest common subsequence of `a` and `b` using Myers' O((N+M)D) algorithm, and appends the matching index pairs to `matches` in order
+                // Returns false (leaving `matches` untouched) if the sequences differ by more than `max_edits` insertions and deletions
+                inline bool myers_matches(const uint64_t *a, size_t n, const uint64_t *b, size_t m, size_t max_edits, std::vector<std::pair<size_t, size_t>> &matches)
+                {
+                    const ptrdiff_t max = static_cast<ptrdiff_t>(std::min(max_edits, n + m));
+                    const ptrdiff_t offset = max + 1;
+                    std::vector<ptrdiff_t> v(2 * max + 3, 0);
+                    std::vector<ptrdiff_t> trace; // Snapshot of v[-d..d] at the start of each round d
+                    ptrdiff_t d;
+
+                    for (d = 0; d <= max; ++d)
+                    {
+                        trace.insert(trace.end(), v.begin() + (offset - d), v.begin() + (offset + d + 1));
+
+                        bool done = false;
+                        for (ptrdiff_t k = -d; k <= d && !done; k += 2)
+                        {
+                            ptrdiff_t x;
+                            if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+                                x = v[offset + k + 1];
+                            else
+                                x = v[offset + k - 1] + 1;
+
+                            ptrdiff_t y = x - k;
+                            while (x < ptrdiff_t(n) && y < ptrdiff_t(m) && a[x] == b[y])
+                                ++x, ++y;
+
+                            v[offset + k] = x;
+                            done = x >= ptrdiff_t(n) && y >= ptrdiff_t(m);
+                        }
+
+                        if (done)
+                            break;
+                    }
 
-                    std::string escape_path(const std::string &key)
+                    if (d > max)
+                        return false;
+
+                    // Walk back through the snapshots to recover the matched diagonals
+                    std::vector<std::pair<size_t, size_t>> reversed;
+                    ptrdiff_t x = n, y = m;
+                    for (; d > 0; --d)
+                    {
+                        const ptrdiff_t *snapshot = trace.data() + d * d + d; // Index of v[0] in round d's snapshot
+                        ptrdiff_t k = x - y, prev_k;
+
+                        if (k == -d || (k != d && snapshot[k - 1] < snapshot[k + 1]))
+                            prev_k = k + 1;
+                        else
+                            prev_k = k - 1;
+
+                        ptrdiff_t prev_x = snapshot[prev_k];
+                        ptrdiff_t prev_y = prev_x - prev_k;
+
+                        while (x > prev_x && y > prev_y)
+                            reversed.push_back(std::make_pair(--x, --y));
+
+                        x = prev_x;
+                        y = prev_y;
+                    }
+
+                    while (x > 0 && y > 0)
+                        reversed.push_back(std::make_pair(--x, --y));
+
+                    matches.insert(matches.end(), reversed.rbegin(), reversed.rend());
+                    return true;
+                }
+
+                class differ
+                {
+                    struct child
                     {
-                        std::string result;
+                        const core::value *key; // NULL if the child is an array element
+                        size_t index;
+                        const core::value *from, *to;
+                    };
 
-                        for (auto c: key)
+                    struct frame
+                    {
+                        size_t path_length;
+                        std::vector<child> children;
+                        size_t next;
+                    };
+
+                    enum element_kind
+                    {
+                        added,
+                        removed,
+                        kept,
+                        substituted,
+                        moved
+                    };
+
+                    static const size_t no_element = -1;
+
+                    subtree_hasher hash;
+                    std::string path;
+                    std::vector<frame> stack;
+                    core::value ops;
+                    size_t max_array_edits;
+
+                    void append_key(const core::value &key)
+                    {
+                        if (!key.is_string())
+                            throw core::error("cppdatalib::core::json::patch - path contains key that is not a string");
+
+                        path.push_back('/');
+                        for (auto c: key.get_string_unchecked())
                         {
                             if (c == '~')
-                                result += "~0";
+                                path += "~0";
                             else if (c == '/')
-                                result += "~1";
+                                path += "~1";
                             else
-                                result.push_back(c);
+                                path.push_back(c);
                         }
+                    }
 
+                    void append_index(size_t index)
+                    {
+                        path.push_back('/');
+                        path += std::to_string(index);
+                    }
+
+                    std::string element_path(size_t index)
+                    {
+                        size_t length = path.size();
+                        append_index(index);
+                        std::string result = path;
+                        path.resize(length);
                         return result;
                     }
 
-                    std::string make_path(core::value::traversal_ancestry_finder finder)
+                    void emit(const char *op, const std::string &op_path, const core::value *v = NULL, const std::string *from = NULL)
+                    {
+                        core::value change;
+
+                        change["op"] = op;
+                        if (from != NULL)
+                            change["from"] = *from;
+                        change["path"] = op_path;
+                        if (v != NULL)
+                            change["value"] = *v;
+
+                        ops.push_back(std::move(change));
+                    }
+
+                    static bool same_container_type(const core::value &from, const core::value &to)
+                    {
+                        return (from.is_array() && to.is_array()) || (from.is_object() && to.is_object());
+                    }
+
+                    // Either replaces `from` with `to` at `op_path`, or queues their members for comparison if they are containers of the same type
+                    void change(child c, const std::string &op_path)
+                    {
+                        if (same_container_type(*c.from, *c.to))
+                            stack.back().children.push_back(c);
+                        else
+                            emit("replace", op_path, c.to);
+                    }
+
+                    void diff_object(const core::value &from, const core::value &to)
                     {
-                        std::string path;
-                        auto ancestors = finder.get_ancestry();
-                        for (size_t i = ancestors.size(); i;)
+                        auto f = from.get_object_unchecked().begin(), f_end = from.get_object_unchecked().end();
+                        auto t = to.get_object_unchecked().begin(), t_end = to.get_object_unchecked().end();
+                        const size_t length = path.size();
+
+                        while (f != f_end || t != t_end)
                         {
-                            core::value::traversal_reference ref = ancestors[--i];
-                            if (ref.is_array())
-                                path += "/" + std::to_string(ref.get_array_index());
-                            else if (ref.is_object())
+                            if (t == t_end || (f != f_end && f->first < t->first))
                             {
-                                if (ref.is_object_key())
-                                    throw core::error("cppdatalib::core::json::patch - path references key, not value");
-                                else if (!ref.get_object_key()->is_string())
-                                    throw core::error("cppdatalib::core::json::patch - path contains key that is not a string");
-
-                                path += "/" + escape_path(ref.get_object_key()->as_string());
+                                append_key(f->first);
+                                emit("remove", path);
+                                ++f;
+                            }
+                            else if (f == f_end || t->first < f->first)
+                            {
+                                append_key(t->first);
+                                emit("add", path, std::addressof(t->second));
+                                ++t;
                             }
                             else
-                                throw core::error("cppdatalib::core::json::patch - path contains non-container");
+                            {
+                                if (hash(f->second) != hash(t->second))
+                                {
+                                    append_key(f->first);
+                                    change(child{std::addressof(f->first), 0, std::addressof(f->second), std::addressof(t->second)}, path);
+                                }
+                                ++f, ++t;
+                            }
+
+                            path.resize(length);
+                        }
+                    }
+
+                    void diff_array(const core::value &from, const core::value &to)
+                    {
+                        const core::array_t::container_type &a = from.get_array_unchecked().data(), &b = to.get_array_unchecked().data();
+                        size_t prefix = 0, n = a.size(), m = b.size();
+
+                        // Identical leading and trailing elements need no edits
+                        while (prefix < n && prefix < m && hash(a[prefix]) == hash(b[prefix]))
+                            ++prefix;
+                        while (n > prefix && m > prefix && hash(a[n-1]) == hash(b[m-1]))
+                            --n, --m;
+                        n -= prefix;
+                        m -= prefix;
+
+                        if (n == 0 && m == 0)
+                            return;
+
+                        std::vector<uint64_t> a_hashes(n), b_hashes(m);
+                        for (size_t i = 0; i < n; ++i)
+                            a_hashes[i] = hash(a[prefix + i]);
+                        for (size_t i = 0; i < m; ++i)
+                            b_hashes[i] = hash(b[prefix + i]);
+
+                        // For each element of the middle sections, where it goes to (in `from`) or comes from (in `to`)
+                        std::vector<size_t> target(n, size_t(no_element)), source(m, size_t(no_element));
+                        std::vector<element_kind> kind(m, added);
+                        std::vector<bool> is_moved(n, false);
+                        std::vector<std::pair<size_t, size_t>> matches;
+
+                        if (myers_matches(a_hashes.data(), n, b_hashes.data(), m, max_array_edits, matches))
+                        {
+                            for (const auto &match: matches)
+                            {
+                                target[match.first] = match.second;
+                                source[match.second] = match.first;
+                                kind[match.second] = kept;
+                            }
+
+                            // Pair up removed and added elements that are identical as moves
+                            std::unordered_multimap<uint64_t, size_t> removed_elements;
+                            for (size_t i = n; i > 0; --i)
+                                if (target[i-1] == no_element)
+                                    removed_elements.insert(std::make_pair(a_hashes[i-1], i-1));
+
+                            for (size_t j = 0; j < m && !removed_elements.empty(); ++j)
+                            {
+                                if (source[j] != no_element)
+                                    continue;
+
+                                auto it = removed_elements.find(b_hashes[j]);
+                                if (it != removed_elements.end())
+                                {
+                                    target[it->second] = j;
+                                    source[j] = it->second;
+                                    kind[j] = moved;
+                                    is_moved[it->second] = true;
+                                    removed_elements.erase(it);
+                                }
+                            }
+                        }
+
+                        // Pair up remaining removed and added elements between the same kept elements as substitutions
+                        matches.push_back(std::make_pair(n, m));
+                        for (size_t match = 0, i = 0, j = 0; match < matches.size(); ++match)
+                        {
+                            while (true)
+                            {
+                                while (i < matches[match].first && target[i] != no_element)
+                                    ++i;
+                                while (j < matches[match].second && source[j] != no_element)
+                                    ++j;
+                                if (i == matches[match].first || j == matches[match].second)
+                                    break;
+
+                                target[i] = j;
+                                source[j] = i;
+                                kind[j] = substituted;
+                            }
+
+                            i = matches[match].first + 1;
+                            j = matches[match].second + 1;
+                        }
+
+                        // Removals are emitted first, from the back, so the indexes in `from` remain valid
+                        for (size_t i = n; i > 0; --i)
+                            if (target[i-1] == no_element)
+                                emit("remove", element_path(prefix + i - 1));
+
+                        // Then the array is rebuilt from the front, tracking which element of `from` is at each index
+                        std::vector<size_t> current;
+                        std::vector<bool> relocated(n, false);
+                        for (size_t i = 0; i < n; ++i)
+                            if (target[i] != no_element)
+                                current.push_back(i);
+
+                        for (size_t j = 0; j < m; ++j)
+                        {
+                            if (kind[j] == added)
+                            {
+                                emit("add", element_path(prefix + j), std::addressof(b[prefix + j]));
+                                current.insert(current.begin() + j, size_t(no_element));
+                                continue;
+                            }
+
+                            // An element that will be moved later is in the way. Move it in front of the next element that stays in place after its destination instead
+                            while (current[j] != source[j] && is_moved[current[j]] && !relocated[current[j]])
+                            {
+                                const size_t blocker = current[j];
+                                size_t anchor = target[blocker] + 1, dest;
+
+                                while (anchor < m && kind[anchor] != kept && kind[anchor] != substituted)
+                                    ++anchor;
+
+                                current.erase(current.begin() + j);
+                                if (anchor == m)
+                                    dest = current.size();
+                                else
+                                    dest = std::find(current.begin() + j, current.end(), source[anchor]) - current.begin();
+                                current.insert(current.begin() + dest, blocker);
+
+                                std::string from_path = element_path(prefix + j);
+                                emit("move", element_path(prefix + dest), NULL, &from_path);
+                                relocated[blocker] = true;
+                            }
+
+                            if (current[j] != source[j])
+                            {
+                                size_t p = std::find(current.begin() + j, current.end(), source[j]) - current.begin();
+
+                                current.erase(current.begin() + p);
+                                current.insert(current.begin() + j, source[j]);
+
+                                std::string from_path = element_path(prefix + p);
+                                emit("move", element_path(prefix + j), NULL, &from_path);
+                            }
+
+                            if (kind[j] == substituted)
+                                change(child{NULL, prefix + j, std::addressof(a[prefix + source[j]]), std::addressof(b[prefix + j])}, element_path(prefix + j));
                         }
-                        return path;
+                    }
+
+                    // Emits the changes directly within `from` and `to`, which must be containers of the same type
+                    // Members that must be compared recursively are queued on the top frame
+                    void diff_container(const core::value &from, const core::value &to)
+                    {
+                        frame f;
+                        f.path_length = path.size();
+                        f.next = 0;
+                        stack.push_back(std::move(f));
+
+                        if (from.is_object())
+                            diff_object(from, to);
+                        else
+                            diff_array(from, to);
                     }
 
                 public:
-                    traverse_diff() : diff(core::array_t()) {}
+                    differ(size_t max_array_edits) : ops(core::array_t()), max_array_edits(max_array_edits) {}
 
-                    const core::value &get_diff() const {return diff;}
+                    core::value run(const core::value &from, const core::value &to)
+                    {
+                        if (hash(from) == hash(to))
+                            return ops;
+                        else if (!same_container_type(from, to))
+                        {
+                            emit("replace", path, &to);
+                            return ops;
+                        }
 
-                    bool operator()(const core::value *arg,
-                                    const core::value *arg2,
-                                    core::value::traversal_ancestry_finder arg_ancestry,
-                                    core::value::traversal_ancestry_finder arg2_ancestry)
+                        diff_container(from, to);
+                        while (!stack.empty())
+                        {
+                            frame &f = stack.back();
+                            if (f.next == f.children.size())
+                            {
+                                stack.pop_back();
+                                continue;
+                            }
+
+                            child c = f.children[f.next++];
+                            path.resize(f.path_length);
+                            if (c.key != NULL)
+                                append_key(*c.key);
+                            else
+                                append_index(c.index);
+
+                            diff_container(*c.from, *c.to);
+                        }
+
+                        return ops;
+                    }
+                };
+            }
+
+            // Returns a JSON Patch (RFC 6902) that transforms `from` into `to`
+            // Identical subtrees are skipped by comparing structural hashes, so unchanged branches cost O(1) after hashing.
+            // Array edits are computed as a minimal sequence of removes, adds, and moves over element hashes; if arrays differ
+            // by more than `max_array_edits` insertions and deletions, their elements are compared by position instead
+            inline core::value diff(const core::value &from, const core::value &to, size_t max_array_edits = 1024)
+            {
+                return impl::differ(max_array_edits).run(from, to);
+            }
+
+            enum operation_type
+            {
+                add_operation,
+                remove_operation,
+                replace_operation,
+                move_operation,
+                copy_operation,
+                test_operation
+            };
+
+            struct operation
+            {
+                operation_type type;
+                pointer::compiled_pointer path;
+                pointer::compiled_pointer from; // Only used by move and copy operations
+                core::value value; // Only used by add, replace, and test operations
+            };
+
+            // A JSON Patch (RFC 6902) that is validated once, with all pointers compiled, so it can be applied to many documents
+            class compiled_patch
+            {
+                std::vector<operation> ops;
+
+                static const core::value &required_member(const core::value &op, const char *name)
+                {
+                    const core::value *member = op.member_ptr(core::value(name));
+                    if (!member)
+                        throw core::error("cppdatalib::core::json::patch - operation is missing a required member");
+                    return *member;
+                }
+
+                static pointer::compiled_pointer required_pointer(const core::value &op, const char *name)
+                {
+                    const core::value &member = required_member(op, name);
+                    if (!member.is_string())
+                        throw core::error("cppdatalib::core::json::patch - operation path must be a string");
+                    return pointer::compiled_pointer(member.get_string_unchecked());
+                }
+
+                // Inserts `v` at `path`, which must refer to an object member or array position whose parent exists
+                static void add(core::value &doc, const pointer::compiled_pointer &path, core::value &&v)
+                {
+                    if (path.empty())
                     {
-                        core::value change;
+                        doc = std::move(v);
+                        return;
+                    }
 
-                        std::cout << (arg? to_json(*arg): "NULL") << " : " << (arg2? to_json(*arg2): "NULL") << std::endl << std::endl;
+                    core::value *parent = path.parent().evaluate(doc);
+                    const size_t last = path.size() - 1;
 
-                        if ((arg_ancestry.get_parent_count() > 0 && arg_ancestry.get_ancestry().front().is_object_key()) ||
-                            (arg2_ancestry.get_parent_count() > 0 && arg2_ancestry.get_ancestry().front().is_object_key()))
-                            return true;
+                    if (parent && parent->is_object())
+                        parent->member(path.key(last)) = std::move(v);
+                    else if (parent && parent->is_array() && path.refers_to_end())
+                        parent->get_array_ref().data().push_back(std::move(v));
+                    else if (parent && parent->is_array() && path.index(last) <= parent->array_size())
+                        parent->get_array_ref().data().insert(parent->get_array_ref().data().begin() + path.index(last), std::move(v));
+                    else
+                        throw core::error("cppdatalib::core::json::patch - target location of 'add' operation does not exist");
+                }
+
+                // Removes the value at `path`, and returns it
+                static core::value remove(core::value &doc, const pointer::compiled_pointer &path)
+                {
+                    core::value result;
+
+                    if (path.empty())
+                    {
+                        std::swap(result, doc);
+                        return result;
+                    }
+
+                    core::value *parent = path.parent().evaluate(doc);
+                    const size_t last = path.size() - 1;
 
-                        if (arg == NULL && arg2 != NULL)
+                    if (parent && parent->is_object())
+                    {
+                        auto it = parent->get_object_ref().data().find(path.key(last));
+                        if (it == parent->get_object_ref().data().end())
+                            throw core::error("cppdatalib::core::json::patch - target location of 'remove' operation does not exist");
+
+                        std::swap(result, it->second);
+                        parent->get_object_ref().data().erase(it);
+                    }
+                    else if (parent && parent->is_array() && path.index(last) < parent->array_size())
+                    {
+                        std::swap(result, parent->get_array_ref().data()[path.index(last)]);
+                        parent->erase_element(path.index(last));
+                    }
+                    else
+                        throw core::error("cppdatalib::core::json::patch - target location of 'remove' operation does not exist");
+
+                    return result;
+                }
+
+            public:
+                compiled_patch() {}
+                explicit compiled_patch(const core::value &patch)
+                {
+                    if (!patch.is_array())
+                        throw core::error("cppdatalib::core::json::patch - patch must be an array of operations");
+
+                    ops.reserve(patch.array_size());
+                    for (const auto &op: patch.get_array_unchecked())
+                    {
+                        operation compiled;
+
+                        if (!op.is_object())
+                            throw core::error("cppdatalib::core::json::patch - patch operation must be an object");
+
+                        const core::value &name = required_member(op, "op");
+                        if (name == "add") compiled.type = add_operation;
+                        else if (name == "remove") compiled.type = remove_operation;
+                        else if (name == "replace") compiled.type = replace_operation;
+                        else if (name == "move") compiled.type = move_operation;
+                        else if (name == "copy") compiled.type = copy_operation;
+                        else if (name == "test") compiled.type = test_operation;
+                        else
+                            throw core::error("cppdatalib::core::json::patch - unknown patch operation");
+
+                        compiled.path = required_pointer(op, "path");
+                        switch (compiled.type)
                         {
-                            change["op"] = "add";
-                            change["path"] = make_path(arg2_ancestry);
-                            change["value"] = *arg2;
+                            case add_operation:
+                            case replace_operation:
+                            case test_operation:
+                                compiled.value = required_member(op, "value");
+                                break;
+                            case move_operation:
+                                compiled.from = required_pointer(op, "from");
+                                if (compiled.path != compiled.from && compiled.path.starts_with(compiled.from))
+                                    throw core::error("cppdatalib::core::json::patch - cannot move a value into one of its children");
+                                break;
+                            case copy_operation:
+                                compiled.from = required_pointer(op, "from");
+                                break;
+                            default:
+                                break;
                         }
-                        else if (arg != NULL && arg2 == NULL)
+
+                        ops.push_back(std::move(compiled));
+                    }
+                }
+
+                const std::vector<operation> &operations() const {return ops;}
+
+                // Applies the patch to `doc` in place. If an operation fails, an error is thrown and `doc` contains the results of the previous operations
+                void apply(core::value &doc) const
+                {
+                    for (const auto &op: ops)
+                    {
+                        switch (op.type)
                         {
-                            change["op"] = "remove";
-                            change["path"] = make_path(arg_ancestry);
+                            case add_operation:
+                                add(doc, op.path, core::value(op.value));
+                                break;
+                            case remove_operation:
+                                remove(doc, op.path);
+                                break;
+                            case replace_operation:
+                            {
+                                core::value *target = op.path.evaluate(doc);
+                                if (!target)
+                                    throw core::error("cppdatalib::core::json::patch - target location of 'replace' operation does not exist");
+                                *target = op.value;
+                                break;
+                            }
+                            case move_operation:
+                                if (op.path != op.from)
+                                    add(doc, op.path, remove(doc, op.from));
+                                break;
+                            case copy_operation:
+                            {
+                                const core::value *source = op.from.evaluate(doc);
+                                if (!source)
+                                    throw core::error("cppdatalib::core::json::patch - source location of 'copy' operation does not exist");
+                                add(doc, op.path, core::value(*source));
+                                break;
+                            }
+                            case test_operation:
+                            {
+                                const core::value *target = op.path.evaluate(doc);
+                                if (!target || *target != op.value)
+                                    throw core::error("cppdatalib::core::json::patch - 'test' operation failed");
+                                break;
+                            }
                         }
-                        else if (arg != NULL && arg2 != NULL &&
-                                 !arg->is_object() && !arg->is_array() &&
-                                 !arg2->is_object() && !arg2->is_array() && *arg != *arg2)
+                    }
+                }
+            };
+
+            // Applies `patch` to `doc` in place
+            inline void apply(core::value &doc, const core::value &patch)
+            {
+                compiled_patch(patch).apply(doc);
+            }
+
+            // Applies a patch to each top-level value as it streams from input to output, so documents larger than memory can be patched.
+            // Only add, remove, replace and test operations are supported, and their targets must appear in the document in the same order as the operations.
+            // Replaced and removed values are skipped, and only the values of test operations are buffered.
+            // An add operation on an object member that does not appear after the previous target is applied at the end of the object.
+            // Consecutive operations on the same object member are applied together, so each member is written at most once
+            class patch_filter : public core::impl::stream_filter_base
+            {
+                enum action
+                {
+                    pass_value,
+                    skip_value,
+                    test_value
+                };
+
+                struct frame
+                {
+                    frame(bool object) : object(object), index(0) {}
+
+                    bool object;
+                    size_t index; // Number of elements written to the array, which is the index of the current element after the previous operations
+                    core::value key; // Current key of the object
+                    std::set<core::value> written; // Keys of the object already written that are named by an add operation
+                };
+
+                std::vector<operation> ops;
+                std::set<core::value> added_keys; // Last reference tokens of all add operations
+                size_t next; // Index of the next operation to apply
+                std::vector<frame> frames;
+                size_t matched; // Number of open containers that contain the target of the next operation
+
+                action pending; // Action for the value of the current object member
+                size_t passing; // Number of open containers and strings within complex keys
+                size_t skipping; // Number of open containers and strings being discarded
+                core::string_t key;
+
+                core::value tested;
+                core::value_builder tester;
+
+                const operation *current() const {return next < ops.size()? &ops[next]: NULL;}
+
+                // Returns true if the reference token `idx` of the next operation's target refers to the current location in frame `idx`
+                bool token_matches(size_t idx) const
+                {
+                    const pointer::compiled_pointer &path = ops[next].path;
+                    if (frames[idx].object)
+                        return frames[idx].key == path.key(idx);
+                    return path.index(idx) == frames[idx].index;
+                }
+
+                // Returns true if the next operation's target is the current value within the innermost container
+                bool at_target() const
+                {
+                    return current() && matched == frames.size() && ops[next].path.size() == frames.size() && token_matches(frames.size() - 1);
+                }
+
+                void advance()
+                {
+                    ++next;
+                    matched = 0;
+                    if (current())
+                    {
+                        const size_t size = ops[next].path.size();
+                        while (matched < frames.size() && matched < size && (matched == 0 || token_matches(matched - 1)))
+                            ++matched;
+                    }
+                }
+
+                // Called when a value (not a key) begins. Applies the operations targeting it, and returns what should be done with it
+                action begin_value()
+                {
+                    if (frames.empty())
+                    {
+                        next = 0;
+                        matched = 0;
+                        if (!current() || !ops[next].path.empty())
+                            return pass_value;
+                    }
+                    else if (frames.back().object)
+                    {
+                        const action result = pending;
+                        pending = pass_value;
+                        return result;
+                    }
+
+                    while (frames.empty() || at_target())
+                    {
+                        const operation &op = ops[next];
+
+                        if (op.type == test_operation)
+                            return test_value;
+
+                        // The root is set to null when removed, like pointer::remove()
+                        if (op.type != remove_operation)
+                            output.write(op.value);
+                        else if (frames.empty())
+                            output.write(core::null_t());
+                        if (!frames.empty() && op.type != remove_operation)
+                            ++frames.back().index;
+                        advance();
+
+                        if (op.type != add_operation || frames.empty())
+                            return skip_value;
+                        // Otherwise, the value was inserted before the current element, and more operations may target it
+                    }
+
+                    return pass_value;
+                }
+
+                // Applies the consecutive operations targeting the current object member to `v`. `exists` is true if the member exists,
+                // and `streamed` is true if its value has not been read yet. Returns false, without applying it, if a test operation needs the streamed value
+                bool apply_member_operations(core::value &v, bool &exists, bool streamed)
+                {
+                    while (at_target())
+                    {
+                        const operation &op = ops[next];
+
+                        if (op.type != add_operation && !exists)
+                            throw core::error("cppdatalib::core::json::patch - operation target does not exist, or is not in document order");
+
+                        switch (op.type)
                         {
-                            change["op"] = "replace";
-                            change["path"] = make_path(arg_ancestry);
-                            change["value"] = *arg2;
+                            case test_operation:
+                                if (streamed)
+                                    return false;
+                                else if (v != op.value)
+                                    throw core::error("cppdatalib::core::json::patch - 'test' operation failed");
+                                break;
+                            case remove_operation:
+                                exists = streamed = false;
+                                break;
+                            default:
+                                v = op.value;
+                                exists = true;
+                                streamed = false;
+                                break;
                         }
 
-                        if (change.is_object())
-                            diff.push_back(change);
+                        advance();
+                    }
+
+                    return true;
+                }
+
+                // Writes the current object member, if it exists
+                void write_member(const core::value &v, bool exists)
+                {
+                    if (!exists)
+                        return;
+
+                    if (added_keys.find(frames.back().key) != added_keys.end())
+                        frames.back().written.insert(frames.back().key);
+                    output.write(frames.back().key);
+                    output.write(v);
+                }
 
+                // Called when an object key is read. Applies the operations targeting its member, and returns true if the key should be written
+                bool found_key(const core::value &k)
+                {
+                    frames.back().key = k;
+                    pending = pass_value;
+                    if (!at_target())
+                    {
+                        if (added_keys.find(k) != added_keys.end())
+                            frames.back().written.insert(k);
                         return true;
                     }
-                };
 
-                struct traverse_diff_postfix
+                    core::value v;
+                    bool exists = true;
+
+                    if (!apply_member_operations(v, exists, true))
+                    {
+                        pending = test_value; // The key is written once the test and the operations after it are applied
+                        return false;
+                    }
+
+                    write_member(v, exists);
+                    pending = skip_value;
+                    return false;
+                }
+
+                // Checks the value of the current test operation. Within an object, applies the operations after the test to the member, then writes it
+                void finish_test(const core::value &v)
                 {
-                public:
-                    bool operator()(const core::value *arg,
-                                    const core::value *arg2,
-                                    core::value::traversal_ancestry_finder,
-                                    core::value::traversal_ancestry_finder)
+                    if (v != ops[next].value)
+                        throw core::error("cppdatalib::core::json::patch - 'test' operation failed");
+                    advance();
+
+                    if (!frames.empty() && frames.back().object)
                     {
-                        std::cout << "POSTFIX: " << (arg? to_json(*arg): "NULL") << " : " << (arg2? to_json(*arg2): "NULL") << std::endl << std::endl;
+                        core::value result = v;
+                        bool exists = true;
+
+                        apply_member_operations(result, exists, false);
+                        write_member(result, exists);
+                    }
+                    else
+                        output.write(v);
+
+                    end_value(true);
+                }
+
+                // Called after a value (not a key) has ended. `written` is false if the value was skipped
+                void end_value(bool written)
+                {
+                    if (!frames.empty() && !frames.back().object)
+                        frames.back().index += written;
+                    else if (frames.empty() && current())
+                        throw core::error("cppdatalib::core::json::patch - operation target does not exist, or is not in document order");
+                }
+
+                // Starts the value of the current location, and returns false if it should not be written to the output
+                bool begin_scope(action a)
+                {
+                    switch (a)
+                    {
+                        case skip_value:
+                            skipping = 1;
+                            return false;
+                        case test_value:
+                            tested.set_null();
+                            tester.begin();
+                            return false;
+                        default:
+                            return true;
+                    }
+                }
+
+                // Compares the buffered value of a test operation, and writes it if the test succeeds
+                void end_test()
+                {
+                    tester.end();
+                    finish_test(tested);
+                }
+
+                // Called before the innermost container ends
+                void end_container()
+                {
+                    const size_t depth = frames.size();
 
+                    // Members and elements added at the end of the container
+                    while (current() && ops[next].type == add_operation && matched == depth && ops[next].path.size() == depth)
+                    {
+                        const operation &op = ops[next];
+
+                        if (frames.back().object)
+                        {
+                            // A member that was already written cannot be added again
+                            if (frames.back().written.find(op.path.key(depth - 1)) != frames.back().written.end())
+                                throw core::error("cppdatalib::core::json::patch - operation target does not exist, or is not in document order");
+
+                            core::value v;
+                            bool exists = false;
+
+                            frames.back().key = op.path.key(depth - 1);
+                            apply_member_operations(v, exists, false);
+                            write_member(v, exists);
+                            continue;
+                        }
+                        else if (!op.path.refers_to_end() && op.path.index(depth - 1) != frames.back().index)
+                            break;
+                        else
+                            ++frames.back().index;
+
+                        output.write(op.value);
+                        advance();
+                    }
+
+                    if (current() && matched >= depth && ops[next].path.size() >= depth)
+                        throw core::error("cppdatalib::core::json::patch - operation target does not exist, or is not in document order");
+                }
+
+            public:
+                patch_filter(core::stream_handler &output, const compiled_patch &patch)
+                    : stream_filter_base(output)
+                    , ops(patch.operations())
+                    , next(0)
+                    , matched(0)
+                    , pending(pass_value)
+                    , passing(0)
+                    , skipping(0)
+                    , tester(tested)
+                {
+                    for (const auto &op: ops)
+                    {
+                        if (op.type == move_operation || op.type == copy_operation)
+                            throw core::error("cppdatalib::core::json::patch - 'move' and 'copy' operations cannot be applied while streaming");
+                        else if (op.type == add_operation && !op.path.empty())
+                            added_keys.insert(op.path.key(op.path.size() - 1));
+                    }
+                }
+
+            protected:
+                void begin_()
+                {
+                    stream_filter_base::begin_();
+                    frames.clear();
+                    next = matched = passing = skipping = 0;
+                    pending = pass_value;
+                }
+
+                bool skip_requested_() const {return skipping > 0;}
+
+                bool write_(const core::value &v, bool is_key)
+                {
+                    if (skipping)
+                        return true;
+                    else if (tester.active())
+                        return tester.write(v), true;
+                    else if (passing)
+                        return output.write(v), true;
+                    else if (is_key)
+                    {
+                        if (found_key(v))
+                            output.write(v);
                         return true;
                     }
-                };
+                    else if (v.is_array() || v.is_object())
+                        return false; // Expand the container, so operations can be applied within it
 
-                traverse_diff traverser;
-                traverse_diff_postfix postfix;
+                    switch (begin_value())
+                    {
+                        case pass_value:
+                            output.write(v);
+                            end_value(true);
+                            break;
+                        case skip_value:
+                            end_value(false);
+                            break;
+                        case test_value:
+                            finish_test(v);
+                            break;
+                    }
 
-                from.parallel_diff_traverse(to, traverser, postfix);
+                    return true;
+                }
 
-                return traverser.get_diff();
-            }
+                void begin_array_(const core::value &v, core::int_t size, bool is_key)
+                {
+                    if (skipping)
+                        ++skipping;
+                    else if (tester.active())
+                        tester.begin_array(v, size);
+                    else if (passing)
+                        ++passing, output.begin_array(v, size);
+                    else if (is_key) // Complex keys never match a target
+                    {
+                        frames.back().key.set_null();
+                        pending = pass_value;
+                        ++passing;
+                        output.begin_array(v, size);
+                    }
+                    else if (begin_scope(begin_value()))
+                    {
+                        if (current() && matched == frames.size() && ops[next].path.size() > frames.size() && (frames.empty() || token_matches(frames.size() - 1)))
+                            ++matched;
+                        frames.push_back(frame(false));
+                        output.begin_array(core::value(core::array_t(), v.get_subtype()), core::stream_handler::unknown_size);
+                    }
+                    else if (tester.active())
+                        tester.begin_array(v, size);
+                }
+                void end_array_(const core::value &v, bool)
+                {
+                    if (skipping)
+                    {
+                        if (--skipping == 0)
+                            end_value(false);
+                    }
+                    else if (tester.active())
+                    {
+                        tester.end_array(v);
+                        if (tester.nesting_depth() == 0)
+                            end_test();
+                    }
+                    else if (passing)
+                        --passing, output.end_array(v);
+                    else
+                    {
+                        end_container();
+                        frames.pop_back();
+                        matched = std::min(matched, frames.size());
+                        output.end_array(v);
+                        end_value(true);
+                    }
+                }
+
+                void begin_object_(const core::value &v, core::int_t size, bool is_key)
+                {
+                    if (skipping)
+                        ++skipping;
+                    else if (tester.active())
+                        tester.begin_object(v, size);
+                    else if (passing)
+                        ++passing, output.begin_object(v, size);
+                    else if (is_key) // Complex keys never match a target
+                    {
+                        frames.back().key.set_null();
+                        pending = pass_value;
+                        ++passing;
+                        output.begin_object(v, size);
+                    }
+                    else if (begin_scope(begin_value()))
+                    {
+                        if (current() && matched == frames.size() && ops[next].path.size() > frames.size() && (frames.empty() || token_matches(frames.size() - 1)))
+                            ++matched;
+                        frames.push_back(frame(true));
+                        output.begin_object(core::value(core::object_t(), v.get_subtype()), core::stream_handler::unknown_size);
+                    }
+                    else if (tester.active())
+                        tester.begin_object(v, size);
+                }
+                void end_object_(const core::value &v, bool)
+                {
+                    if (skipping)
+                    {
+                        if (--skipping == 0)
+                            end_value(false);
+                    }
+                    else if (tester.active())
+                    {
+                        tester.end_object(v);
+                        if (tester.nesting_depth() == 0)
+                            end_test();
+                    }
+                    else if (passing)
+                        --passing, output.end_object(v);
+                    else
+                    {
+                        end_container();
+                        frames.pop_back();
+                        matched = std::min(matched, frames.size());
+                        output.end_object(v);
+                        end_value(true);
+                    }
+                }
+
+                void begin_string_(const core::value &v, core::int_t size, bool is_key)
+                {
+                    if (skipping)
+                        ++skipping;
+                    else if (tester.active())
+                        tester.begin_string(v, size);
+                    else if (passing)
+                        ++passing, output.begin_string(v, size);
+                    else if (is_key)
+                        key.clear();
+                    else if (begin_scope(begin_value()))
+                        ++passing, output.begin_string(v, size);
+                    else if (tester.active())
+                        tester.begin_string(v, size);
+                }
+                void string_data_(const core::value &v, bool is_key)
+                {
+                    if (skipping)
+                        return;
+                    else if (tester.active())
+                        tester.append_to_string(v);
+                    else if (passing)
+                        output.append_to_string(v);
+                    else if (is_key)
+                        key += v.get_string_unchecked();
+                }
+                void end_string_(const core::value &v, bool is_key)
+                {
+                    if (skipping)
+                    {
+                        if (--skipping == 0)
+                            end_value(false);
+                    }
+                    else if (tester.active())
+                    {
+                        tester.end_string(v);
+                        if (tester.nesting_depth() == 0)
+                            end_test();
+                    }
+                    else if (passing)
+                    {
+                        --passing;
+                        output.end_string(v);
+                        if (passing == 0 && !is_key)
+                            end_value(true);
+                    }
+                    else if (is_key)
+                    {
+                        const core::value k(key, v.get_subtype());
+                        if (found_key(k))
+                            output.write(k);
+                    }
+                }
+            };
         }
     }
 }
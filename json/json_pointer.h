@@ -280,6 +280,195 @@ namespace cppdatalib
                 }
             }
 
+            // A JSON pointer that is tokenized and unescaped once (with array indexes precomputed), so it can be evaluated without allocating
+            class compiled_pointer
+            {
+                core::impl::pointer_path path;
+
+            public:
+                compiled_pointer() {}
+                explicit compiled_pointer(const std::string &pointer)
+                {
+                    if (!pointer.empty() && pointer[0] != '/')
+                        throw core::error("JSON Pointer - Expected empty path or '/' beginning path");
+                    else if (!path.parse(pointer))
+                        throw core::error("JSON Pointer - Expected identifier following '~'");
+                }
+
+                size_t size() const {return path.size();}
+                bool empty() const {return path.empty();}
+
+                // Returns the unescaped reference token at `idx`, as a string value
+                const core::value &key(size_t idx) const {return path.tokens[idx];}
+
+                // Returns the array index referred to by the reference token at `idx`, or -1 if the token is not a valid array index
+                size_t index(size_t idx) const {return path.indexes[idx];}
+
+                // Returns true if the last reference token is "-", referring to the end of an array
+                bool refers_to_end() const {return !empty() && key(size() - 1).get_string_unchecked() == "-";}
+
+                // Returns the pointer to the parent of the referenced value (the root has no parent, and is its own parent)
+                compiled_pointer parent() const
+                {
+                    compiled_pointer result(*this);
+
+                    if (!result.empty())
+                    {
+                        result.path.tokens.pop_back();
+                        result.path.indexes.pop_back();
+                    }
+
+                    return result;
+                }
+
+                // Returns true if this pointer refers to `other` or one of its descendants
+                bool starts_with(const compiled_pointer &other) const
+                {
+                    return other.size() <= size() && std::equal(other.path.tokens.begin(), other.path.tokens.end(), path.tokens.begin());
+                }
+
+                // Returns the escaped string representation of the pointer
+                std::string to_string() const
+                {
+                    std::string result;
+
+                    for (const auto &token: path.tokens)
+                    {
+                        result.push_back('/');
+                        for (auto c: token.get_string_unchecked())
+                        {
+                            if (c == '~')
+                                result += "~0";
+                            else if (c == '/')
+                                result += "~1";
+                            else
+                                result.push_back(c);
+                        }
+                    }
+
+                    return result;
+                }
+
+                bool operator==(const compiled_pointer &other) const {return path.tokens == other.path.tokens;}
+                bool operator!=(const compiled_pointer &other) const {return !(*this == other);}
+                bool operator<(const compiled_pointer &other) const {return path.tokens < other.path.tokens;}
+
+                // Returns the referenced value, or NULL if it does not exist
+                const core::value *evaluate(const core::value &root) const {return path.evaluate(root);}
+                core::value *evaluate(core::value &root) const {return const_cast<core::value *>(path.evaluate(root));}
+            };
+
+            // A set of compiled JSON pointers that are resolved against the same document together.
+            // Pointers are stored in a trie, so values referred to by common prefixes are only looked up once
+            class compiled_pointer_set
+            {
+                struct node
+                {
+                    node(const core::value &key = core::value(), size_t index = -1) : key(key), index(index) {}
+
+                    core::value key; // Reference token leading to this node
+                    size_t index; // Array index of the reference token, or -1 if the token is not a valid array index
+                    std::vector<size_t> children;
+                    std::vector<size_t> pointers; // Pointers that refer to this node
+                };
+
+                std::vector<node> nodes;
+                size_t pointer_count;
+
+                template<typename Value, typename Results>
+                void evaluate(size_t idx, Value &v, Results &results) const
+                {
+                    for (auto pointer: nodes[idx].pointers)
+                        results[pointer] = &v;
+
+                    for (auto child: nodes[idx].children)
+                    {
+                        const node &n = nodes[child];
+
+                        if (v.is_object())
+                        {
+                            Value *p = const_cast<Value *>(v.member_ptr(n.key));
+                            if (p)
+                                evaluate(child, *p, results);
+                        }
+                        else if (v.is_array() && n.index < v.array_size())
+                            evaluate(child, const_cast<Value &>(v.get_array_unchecked().data()[n.index]), results);
+                    }
+                }
+
+            public:
+                compiled_pointer_set() : nodes(1), pointer_count(0) {}
+
+                // Adds a pointer to the set, and returns its index in the results of `evaluate()`
+                size_t add(const compiled_pointer &pointer)
+                {
+                    size_t idx = 0;
+
+                    for (size_t i = 0; i < pointer.size(); ++i)
+                    {
+                        size_t next = 0;
+
+                        for (auto child: nodes[idx].children)
+                            if (nodes[child].key == pointer.key(i))
+                            {
+                                next = child;
+                                break;
+                            }
+
+                        if (next == 0)
+                        {
+                            next = nodes.size();
+                            nodes.push_back(node(pointer.key(i), pointer.index(i)));
+                            nodes[idx].children.push_back(next);
+                        }
+
+                        idx = next;
+                    }
+
+                    nodes[idx].pointers.push_back(pointer_count);
+                    return pointer_count++;
+                }
+                size_t add(const std::string &pointer) {return add(compiled_pointer(pointer));}
+
+                size_t size() const {return pointer_count;}
+
+                // Resolves all pointers against `root`. Afterward, `results[i]` is the value referred to by the pointer with index i, or NULL if it does not exist
+                void evaluate(const core::value &root, std::vector<const core::value *> &results) const
+                {
+                    results.assign(pointer_count, NULL);
+                    evaluate(0, root, results);
+                }
+                void evaluate(core::value &root, std::vector<core::value *> &results) const
+                {
+                    results.assign(pointer_count, NULL);
+                    evaluate(0, root, results);
+                }
+            };
+
+            // Returns true if the object pointed to by pointer exists
+            inline bool exists(const core::value &value, const compiled_pointer &pointer)
+            {
+                return pointer.evaluate(value) != NULL;
+            }
+
+            // Returns the object pointed to by pointer
+            inline const core::value &deref(const core::value &value, const compiled_pointer &pointer)
+            {
+                const core::value *result = pointer.evaluate(value);
+                if (!result)
+                    throw core::error("JSON Pointer - Attempted to dereference non-existent value");
+                return *result;
+            }
+
+            // Returns the object pointed to by pointer
+            inline core::value &deref(core::value &value, const compiled_pointer &pointer)
+            {
+                core::value *result = pointer.evaluate(value);
+                if (!result)
+                    throw core::error("JSON Pointer - Attempted to dereference non-existent value");
+                return *result;
+            }
+
             // Returns true if the object pointed to by pointer exists
             inline bool exists(const core::value &value, const std::string &pointer)
             {
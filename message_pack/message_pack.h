@@ -74,6 +74,76 @@ namespace cppdatalib
                 return size;
             }
 
+            // Skips the next `values` encoded values, without decoding them
+            void skip_current_value(uint64_t values)
+            {
+                while (values > 0)
+                {
+                    uint64_t size = 0;
+                    int chr = stream().get();
+
+                    --values;
+                    if (chr == EOF)
+                        throw core::error("MessagePack - unexpected end of stream, expected type specifier");
+
+                    if (chr < 0x80 || chr >= 0xe0) // Fixint
+                        continue;
+                    else if (chr < 0x90) // Fixmap
+                        values += 2 * (chr & 0xf);
+                    else if (chr < 0xa0) // Fixarray
+                        values += chr & 0xf;
+                    else if (chr < 0xc0) // Fixstr
+                        size = chr & 0x1f;
+                    else switch (chr)
+                    {
+                        case 0xc4: case 0xd9: if (!core::read_uint8(stream(), size)) throw core::error("MessagePack - expected 'string' length"); break;
+                        case 0xc5: case 0xda: if (!core::read_uint16_be(stream(), size)) throw core::error("MessagePack - expected 'string' length"); break;
+                        case 0xc6: case 0xdb: if (!core::read_uint32_be(stream(), size)) throw core::error("MessagePack - expected 'string' length"); break;
+                        case 0xc7: if (!core::read_uint8(stream(), size)) throw core::error("MessagePack - expected 'extension' length"); ++size; break;
+                        case 0xc8: if (!core::read_uint16_be(stream(), size)) throw core::error("MessagePack - expected 'extension' length"); ++size; break;
+                        case 0xc9: if (!core::read_uint32_be(stream(), size)) throw core::error("MessagePack - expected 'extension' length"); ++size; break;
+                        case 0xcc: case 0xd0: size = 1; break;
+                        case 0xcd: case 0xd1: size = 2; break;
+                        case 0xca: case 0xce: case 0xd2: size = 4; break;
+                        case 0xcb: case 0xcf: case 0xd3: size = 8; break;
+                        case 0xd4: size = 2; break;
+                        case 0xd5: size = 3; break;
+                        case 0xd6: size = 5; break;
+                        case 0xd7: size = 9; break;
+                        case 0xd8: size = 17; break;
+                        case 0xdc:
+                        case 0xdd:
+                        case 0xde:
+                        case 0xdf:
+                        {
+                            uint32_t count;
+
+                            if (((chr == 0xdc || chr == 0xde) && !core::read_uint16_be(stream(), count)) ||
+                                ((chr == 0xdd || chr == 0xdf) && !core::read_uint32_be(stream(), count)))
+                                throw core::error("MessagePack - expected container length");
+                            values += chr >= 0xde? 2 * uint64_t(count): count;
+                            break;
+                        }
+                        default: break;
+                    }
+
+                    if (size > 0 && !core::skip_bytes(stream(), size))
+                        throw core::error("MessagePack - unexpected end of stream");
+                }
+            }
+
+            // Skips the contents of the string just begun, if the output requests it. Returns true if the string was skipped
+            bool skip_string(const core::value &string_type, uint32_t size)
+            {
+                if (!get_output()->skip_requested())
+                    return false;
+
+                if (!core::skip_bytes(stream(), size))
+                    throw core::error("MessagePack - unexpected end of string");
+                get_output()->end_string(string_type);
+                return true;
+            }
+
         public:
             parser(core::istream_handle input)
                 : core::stream_parser(input)
@@ -128,13 +198,25 @@ namespace cppdatalib
                 {
                     chr &= 0xf;
                     get_output()->begin_object(core::object_t(), chr);
-                    containers.push(container_data(core::normal, chr));
+                    if (get_output()->skip_requested())
+                    {
+                        skip_current_value(2 * chr);
+                        get_output()->end_object(core::object_t());
+                    }
+                    else
+                        containers.push(container_data(core::normal, chr));
                 }
                 else if (chr < 0xa0) // Fixarray
                 {
                     chr &= 0xf;
                     get_output()->begin_array(core::array_t(), chr);
-                    containers.push(container_data(core::normal, chr));
+                    if (get_output()->skip_requested())
+                    {
+                        skip_current_value(chr);
+                        get_output()->end_array(core::array_t());
+                    }
+                    else
+                        containers.push(container_data(core::normal, chr));
                 }
                 else if (chr < 0xc0) // Fixstr
                 {
@@ -172,6 +254,9 @@ namespace cppdatalib
 
                         string_type.set_subtype(core::blob);
                         get_output()->begin_string(string_type, size);
+                        if (skip_string(string_type, size))
+                            break;
+
                         while (size > 0)
                         {
                             core::int_t buffer_size = std::min(core::int_t(core::buffer_size), core::int_t(size));
@@ -267,6 +352,9 @@ namespace cppdatalib
                             throw core::error("MessagePack - expected 'binary data' length");
 
                         get_output()->begin_string(string_type, size);
+                        if (skip_string(string_type, size))
+                            break;
+
                         while (size > 0)
                         {
                             core::int_t buffer_size = std::min(core::int_t(core::buffer_size), core::int_t(size));
@@ -293,7 +381,13 @@ namespace cppdatalib
                             throw core::error("MessagePack - expected 'array' length");
 
                         get_output()->begin_array(core::array_t(), size);
-                        containers.push(container_data(core::normal, size));
+                        if (get_output()->skip_requested())
+                        {
+                            skip_current_value(size);
+                            get_output()->end_array(core::array_t());
+                        }
+                        else
+                            containers.push(container_data(core::normal, size));
                         break;
                     }
                     // Maps
@@ -307,7 +401,13 @@ namespace cppdatalib
                             throw core::error("MessagePack - expected 'object' length");
 
                         get_output()->begin_object(core::object_t(), size);
-                        containers.push(container_data(core::normal, size));
+                        if (get_output()->skip_requested())
+                        {
+                            skip_current_value(2 * uint64_t(size));
+                            get_output()->end_object(core::object_t());
+                        }
+                        else
+                            containers.push(container_data(core::normal, size));
                         break;
                     }
                 }
@@ -507,6 +607,41 @@ namespace cppdatalib
             void integer_(const core::value &v) {write_int(stream(), v.get_int_unchecked());}
             void uinteger_(const core::value &v) {write_int(stream(), v.get_uint_unchecked());}
             void real_(const core::value &v) {write_float(stream(), v.get_real_unchecked());}
+
+            bool write_array_of_(const int64_t *data, size_t size)
+            {
+                for (size_t i = 0; i < size; ++i)
+                    write_int(stream(), core::int_t(data[i]));
+                return true;
+            }
+            bool write_array_of_(const uint64_t *data, size_t size)
+            {
+                for (size_t i = 0; i < size; ++i)
+                    write_int(stream(), core::uint_t(data[i]));
+                return true;
+            }
+            bool write_array_of_(const double *data, size_t size)
+            {
+                for (size_t i = 0; i < size; ++i)
+                    write_float(stream(), data[i]);
+                return true;
+            }
+            bool write_array_of_(const float *data, size_t size)
+            {
+                // Single-precision values can always be written losslessly as 32-bit floats
+                for (size_t i = 0; i < size; ++i)
+                {
+                    uint32_t temp = core::float_to_ieee_754(data[i]);
+
+                    stream().put(static_cast<unsigned char>(0xca))
+                            .put((temp >> 24) & 0xff)
+                            .put((temp >> 16) & 0xff)
+                            .put((temp >> 8) & 0xff)
+                            .put(temp & 0xff);
+                }
+                return true;
+            }
+
             void begin_string_(const core::value &v, core::int_t size, bool)
             {
                 if (size == unknown_size)
@@ -37,102 +37,90 @@ namespace cppdatalib
         {
             class stream_writer_base : public core::stream_handler, public core::stream_writer
             {
+                core::impl::encoded_size_cache container_sizes;
+
             public:
                 stream_writer_base(core::ostream_handle &output) : core::stream_writer(output) {}
 
             protected:
-                size_t get_size(const core::value &v)
+                // Returns the encoded size of a scalar (or string) value
+                static size_t get_scalar_size(const core::value &v)
+                {
+                    core::ostringstream stream;
+
+                    switch (v.get_type())
+                    {
+                        case core::null: return 3; // "0:,"
+                        case core::boolean: return 7 + !v.get_bool_unchecked(); // "4:true," or "5:false,"
+                        case core::integer: stream << v.get_int_unchecked(); break;
+                        case core::uinteger: stream << v.get_uint_unchecked(); break;
+                        case core::real:
+                            stream.precision(CPPDATALIB_REAL_DIG);
+                            stream << v.get_real_unchecked();
+                            break;
+                        case core::string: return get_netstring_size(v.string_size());
+                        default: return 0;
+                    }
+
+                    return get_netstring_size(stream.str().size());
+                }
+
+                // Returns the size of a netstring with `size` bytes of data
+                static size_t get_netstring_size(uint64_t size)
+                {
+                    return 2 + size + std::to_string(size).size();
+                }
+
+                // Returns the encoded size of the contents of `v`, which must be an array or object.
+                // The sizes of all nested containers are computed at the same time, and stored for when they are written
+                uint64_t get_size(const core::value &v)
                 {
                     struct traverser
                     {
                     private:
-                        std::stack<size_t, std::vector<size_t>> size;
+                        core::impl::encoded_size_cache &cache;
+                        std::vector<size_t> containers;
 
                     public:
-                        traverser() {size.push(0);}
-
-                        size_t get_size() const {return size.top();}
+                        traverser(core::impl::encoded_size_cache &cache) : cache(cache) {}
 
                         bool operator()(const core::value *arg, core::value::traversal_ancestry_finder, bool prefix)
                         {
-                            switch (arg->get_type())
+                            if (arg->is_array() || arg->is_object())
                             {
-                                case core::null:
-                                    if (prefix)
-                                        size.top() += 3; // "0:,"
-                                    break;
-                                case core::boolean:
-                                    if (prefix)
-                                        size.top() += 7 + arg->get_bool_unchecked(); // "4:true," or "5:false,"
-                                    break;
-                                case core::integer:
-                                {
-                                    if (prefix)
-                                    {
-                                        core::ostringstream stream;
-                                        stream << arg->get_int_unchecked();
-                                        stream << stream.str().size();
-                                        size.top() += 2 + stream.str().size();
-                                    }
-                                    break;
-                                }
-                                case core::uinteger:
-                                {
-                                    if (prefix)
-                                    {
-                                        core::ostringstream stream;
-                                        stream << arg->get_uint_unchecked();
-                                        stream << stream.str().size();
-                                        size.top() += 2 + stream.str().size();
-                                    }
-                                    break;
-                                }
-                                case core::real:
+                                if (prefix)
+                                    containers.push_back(cache.add(*arg));
+                                else
                                 {
-                                    if (prefix)
-                                    {
-                                        core::ostringstream stream;
-                                        stream.precision(CPPDATALIB_REAL_DIG);
-                                        stream << arg->get_real_unchecked();
-                                        stream << stream.str().size();
-                                        size.top() += 2 + stream.str().size();
-                                    }
-                                    break;
-                                }
-                                case core::string:
-                                {
-                                    if (prefix)
-                                        size.top() += 2 + arg->string_size() + std::to_string(arg->string_size()).size();
-                                    break;
-                                }
-                                case core::array:
-                                case core::object:
-                                {
-                                    if (prefix)
-                                    {
-                                        size.push(0);
-                                    }
-                                    else
-                                    {
-                                        size_t temp = size.top() + (size.size() > 2? std::to_string(size.top()).size() + 2: 0);
-                                        size.pop();
-                                        size.top() += temp;
-                                    }
-
-                                    break;
+                                    uint64_t size = cache.size_at(containers.back());
+                                    containers.pop_back();
+
+                                    if (!containers.empty())
+                                        cache.size_at(containers.back()) += get_netstring_size(size);
                                 }
                             }
+                            else if (prefix && !containers.empty())
+                                cache.size_at(containers.back()) += get_scalar_size(*arg);
 
                             return true;
                         }
                     };
 
-                    traverser t;
+                    uint64_t size = 0;
 
-                    v.traverse(t);
+                    if (!container_sizes.take(v, size))
+                    {
+                        traverser t(container_sizes);
 
-                    return t.get_size();
+                        container_sizes.clear();
+                        v.traverse(t);
+                        container_sizes.take(v, size);
+                    }
+
+                    return size;
                 }
+
+                void begin_() {container_sizes.clear();}
             };
         }
 
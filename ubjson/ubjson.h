@@ -49,6 +49,109 @@ namespace cppdatalib
             std::unique_ptr<char []> buffer;
             std::stack<container_data, std::vector<container_data>> containers;
 
+            // Decoded elements of strongly-typed numeric arrays
+            std::vector<int64_t> int_block;
+            std::vector<float> float_block;
+            std::vector<double> double_block;
+
+            // Returns the size in bytes of one element of a strongly-typed numeric array, or 0 if `type` is not numeric
+            static size_t typed_element_size(char type)
+            {
+                switch (type)
+                {
+                    case 'U':
+                    case 'i': return 1;
+                    case 'I': return 2;
+                    case 'l':
+                    case 'd': return 4;
+                    case 'L':
+                    case 'D': return 8;
+                    default: return 0;
+                }
+            }
+
+            // Reads as many elements of the current strongly-typed numeric array as fit in the buffer,
+            // decodes them all at once, and passes them to the output handler in bulk
+            void read_typed_array_block()
+            {
+                container_data &container = containers.top();
+                const size_t element_size = typed_element_size(container.content_type);
+                const size_t count = static_cast<size_t>(std::min(container.remaining_size, core::int_t(core::buffer_size / element_size)));
+                const unsigned char *data = reinterpret_cast<const unsigned char *>(buffer.get());
+
+                stream().read(buffer.get(), count * element_size);
+                if (stream().fail())
+                    throw core::error("UBJSON - unexpected end of strongly-typed array");
+
+                container.remaining_size -= count;
+
+                switch (container.content_type)
+                {
+                    case 'd':
+                        float_block.resize(count);
+                        for (size_t i = 0; i < count; ++i, data += 4)
+                            float_block[i] = core::float_from_ieee_754(uint32_t(data[0]) << 24 |
+                                                                       uint32_t(data[1]) << 16 |
+                                                                       uint32_t(data[2]) <<  8 |
+                                                                       uint32_t(data[3]));
+
+                        get_output()->write_array_of(float_block.data(), count);
+                        break;
+                    case 'D':
+                        double_block.resize(count);
+                        for (size_t i = 0; i < count; ++i, data += 8)
+                            double_block[i] = core::double_from_ieee_754(uint64_t(data[0]) << 56 |
+                                                                         uint64_t(data[1]) << 48 |
+                                                                         uint64_t(data[2]) << 40 |
+                                                                         uint64_t(data[3]) << 32 |
+                                                                         uint64_t(data[4]) << 24 |
+                                                                         uint64_t(data[5]) << 16 |
+                                                                         uint64_t(data[6]) <<  8 |
+                                                                         uint64_t(data[7]));
+
+                        get_output()->write_array_of(double_block.data(), count);
+                        break;
+                    default:
+                        int_block.resize(count);
+                        switch (container.content_type)
+                        {
+                            case 'U':
+                                for (size_t i = 0; i < count; ++i)
+                                    int_block[i] = data[i];
+                                break;
+                            case 'i':
+                                for (size_t i = 0; i < count; ++i)
+                                    int_block[i] = static_cast<int8_t>(data[i]);
+                                break;
+                            case 'I':
+                                for (size_t i = 0; i < count; ++i, data += 2)
+                                    int_block[i] = static_cast<int16_t>(uint16_t(data[0]) << 8 | data[1]);
+                                break;
+                            case 'l':
+                                for (size_t i = 0; i < count; ++i, data += 4)
+                                    int_block[i] = static_cast<int32_t>(uint32_t(data[0]) << 24 |
+                                                                        uint32_t(data[1]) << 16 |
+                                                                        uint32_t(data[2]) <<  8 |
+                                                                        uint32_t(data[3]));
+                                break;
+                            case 'L':
+                                for (size_t i = 0; i < count; ++i, data += 8)
+                                    int_block[i] = static_cast<int64_t>(uint64_t(data[0]) << 56 |
+                                                                        uint64_t(data[1]) << 48 |
+                                                                        uint64_t(data[2]) << 40 |
+                                                                        uint64_t(data[3]) << 32 |
+                                                                        uint64_t(data[4]) << 24 |
+                                                                        uint64_t(data[5]) << 16 |
+                                                                        uint64_t(data[6]) <<  8 |
+                                                                        uint64_t(data[7]));
+                                break;
+                        }
+
+                        get_output()->write_array_of(int_block.data(), count);
+                        break;
+                }
+            }
+
             inline char size_specifier(core::int_t min, core::int_t max)
             {
                 if (min >= 0 && max <= UINT8_MAX)
@@ -191,7 +294,12 @@ namespace cppdatalib
                     if (size < 0) throw core::error("UBJSON - invalid negative size specified for high-precision number");
 
                     writer.begin_string(core::value(core::string_t(), core::bignum), size);
-                    while (size > 0)
+                    if (writer.skip_requested())
+                    {
+                        if (!core::skip_bytes(stream(), size))
+                            throw core::error("UBJSON - expected high-precision number value after type specifier");
+                    }
+                    else while (size > 0)
                     {
                         core::int_t buffer_size = std::min(core::int_t(core::buffer_size), size);
                         stream().read(buffer.get(), buffer_size);
@@ -210,7 +318,12 @@ namespace cppdatalib
                     if (size < 0) throw core::error("UBJSON - invalid negative size specified for string");
 
                     writer.begin_string(core::string_t(), size);
-                    while (size > 0)
+                    if (writer.skip_requested())
+                    {
+                        if (!core::skip_bytes(stream(), size))
+                            throw core::error("UBJSON - expected string value after type specifier");
+                    }
+                    else while (size > 0)
                     {
                         core::int_t buffer_size = std::min(core::int_t(core::buffer_size), size);
                         stream().read(buffer.get(), buffer_size);
@@ -227,6 +340,139 @@ namespace cppdatalib
                 return stream();
             }
 
+            // Reads the optional type and count of an array or object, after the opening bracket. `size` is set to -1 if no count is specified
+            void read_container_header(char &type, core::int_t &size, bool object)
+            {
+                const char valid_types[] = "ZTFUiIlLdDCHS[{";
+                int chr = stream().get();
+
+                type = 0;
+                size = -1;
+
+                if (chr == EOF) throw core::error(object? "UBJSON - expected object value after '{'": "UBJSON - expected array value after '['");
+
+                if (chr == '$') // Type specified
+                {
+                    chr = stream().get();
+                    if (chr == EOF || !strchr(valid_types, chr)) throw core::error("UBJSON - expected type specifier after '$'");
+                    type = chr;
+                    chr = stream().get();
+                    if (chr == EOF) throw core::error(object? "UBJSON - unexpected end of object": "UBJSON - unexpected end of array");
+                }
+
+                if (chr == '#') // Count specified
+                {
+                    chr = stream().get();
+                    if (chr == EOF) throw core::error("UBJSON - expected count specifier after '#'");
+
+                    read_int(size, chr);
+                    if (size < 0) throw core::error(object? "UBJSON - invalid negative size specified for object": "UBJSON - invalid negative size specified for array");
+                }
+
+                // If type != 0, then size must be >= 0
+                if (type != 0 && size < 0)
+                    throw core::error(object? "UBJSON - object element type specified but number of elements is not specified": "UBJSON - array element type specified but number of elements is not specified");
+                else if (size < 0) // Unless a count was read, one character needs to be put back (from checking chr == '#')
+                    stream().unget();
+            }
+
+            // Skips a string or high-precision number, after its type specifier
+            void skip_string()
+            {
+                core::int_t size;
+                int c = stream().get();
+
+                if (c == EOF) throw core::error("UBJSON - expected string value after type specifier");
+                read_int(size, c);
+                if (size < 0) throw core::error("UBJSON - invalid negative size specified for string");
+                if (!core::skip_bytes(stream(), size)) throw core::error("UBJSON - expected string value after type specifier");
+            }
+
+            // Skips the contents of the array or object just begun, with the specified element type and count, up to and including the closing bracket (if any)
+            void skip_current_value(char type, core::int_t size, bool object)
+            {
+                struct frame
+                {
+                    char type;
+                    core::int_t remaining;
+                    bool object;
+                };
+
+                std::vector<frame> frames(1, frame{type, size, object});
+
+                while (!frames.empty())
+                {
+                    frame f = frames.back();
+                    int chr;
+
+                    if (f.remaining == 0)
+                    {
+                        frames.pop_back();
+                        continue;
+                    }
+                    else if (!f.object && typed_element_size(f.type)) // Strongly-typed numeric arrays are skipped all at once
+                    {
+                        if (!core::skip_bytes(stream(), f.remaining * typed_element_size(f.type)))
+                            throw core::error("UBJSON - unexpected end of strongly-typed array");
+                        frames.pop_back();
+                        continue;
+                    }
+
+                    if (f.remaining < 0) // Look for the closing bracket
+                    {
+                        chr = stream().get();
+                        if (chr == EOF) throw core::error("UBJSON - unexpected end of stream");
+                        else if (chr == (f.object? '}': ']'))
+                        {
+                            frames.pop_back();
+                            continue;
+                        }
+                        else if (chr == 'N')
+                            continue;
+                        stream().unget();
+                    }
+                    else
+                        --frames.back().remaining;
+
+                    if (f.object) // Keys have no type specifier
+                        skip_string();
+
+                    if (f.type)
+                        chr = f.type;
+                    else if ((chr = stream().get()) == EOF)
+                        throw core::error("UBJSON - unexpected end of stream");
+
+                    switch (chr)
+                    {
+                        case 'Z':
+                        case 'T':
+                        case 'F':
+                        case 'N': break;
+                        case 'C':
+                        case 'U':
+                        case 'i':
+                        case 'I':
+                        case 'l':
+                        case 'L':
+                        case 'd':
+                        case 'D':
+                            if (!core::skip_bytes(stream(), chr == 'C'? 1: typed_element_size(chr)))
+                                throw core::error("UBJSON - unexpected end of stream");
+                            break;
+                        case 'H':
+                        case 'S': skip_string(); break;
+                        case '[':
+                        case '{':
+                            read_container_header(f.type, f.remaining, chr == '{');
+                            f.object = chr == '{';
+                            frames.push_back(f);
+                            break;
+                        default:
+                            throw core::error("UBJSON - expected value");
+                    }
+                }
+            }
+
         public:
             parser(core::istream_handle input)
                 : core::stream_parser(input)
@@ -245,9 +491,24 @@ namespace cppdatalib
         protected:
             void write_one_()
             {
-                const char valid_types[] = "ZTFUiIlLdDCHS[{";
                 int chr;
 
+                // Strongly-typed numeric arrays are decoded in blocks, rather than one element at a time
+                if (containers.size() > 0 &&
+                        containers.top().remaining_size > 0 &&
+                        typed_element_size(containers.top().content_type) &&
+                        get_output()->current_container() == core::array)
+                {
+                    read_typed_array_block();
+
+                    if (containers.top().remaining_size == 0)
+                    {
+                        get_output()->end_array(core::array_t());
+                        containers.pop();
+                    }
+                    return;
+                }
+
                 if (containers.size() > 0)
                 {
                     if (containers.top().content_type)
@@ -311,38 +572,18 @@ namespace cppdatalib
                     case 'N': break;
                     case '[':
                     {
-                        int type = 0;
-                        core::int_t size = -1;
-
-                        chr = stream().get();
-                        if (chr == EOF) throw core::error("UBJSON - expected array value after '['");
+                        char type;
+                        core::int_t size;
 
-                        if (chr == '$') // Type specified
-                        {
-                            chr = stream().get();
-                            if (chr == EOF || !strchr(valid_types, chr)) throw core::error("UBJSON - expected type specifier after '$'");
-                            type = chr;
-                            chr = stream().get();
-                            if (chr == EOF) throw core::error("UBJSON - unexpected end of array");
-                        }
-
-                        if (chr == '#') // Count specified
+                        read_container_header(type, size, false);
+                        get_output()->begin_array(core::array_t(), size >= 0? size: core::int_t(core::stream_handler::unknown_size));
+                        if (get_output()->skip_requested())
                         {
-                            chr = stream().get();
-                            if (chr == EOF) throw core::error("UBJSON - expected count specifier after '#'");
-
-                            read_int(size, chr);
-                            if (size < 0) throw core::error("UBJSON - invalid negative size specified for array");
+                            skip_current_value(type, size, false);
+                            get_output()->end_array(core::array_t());
                         }
-
-                        // If type != 0, then size must be >= 0
-                        if (type != 0 && size < 0)
-                            throw core::error("UBJSON - array element type specified but number of elements is not specified");
-                        else if (size < 0) // Unless a count was read, one character needs to be put back (from checking chr == '#')
-                            stream().unget();
-
-                        get_output()->begin_array(core::array_t(), size >= 0? size: core::int_t(core::stream_handler::unknown_size));
-                        containers.push(container_data(type, size));
+                        else
+                            containers.push(container_data(type, size));
 
                         break;
                     }
@@ -355,38 +596,18 @@ namespace cppdatalib
                         break;
                     case '{':
                     {
-                        int type = 0;
-                        core::int_t size = -1;
+                        char type;
+                        core::int_t size;
 
-                        chr = stream().get();
-                        if (chr == EOF) throw core::error("UBJSON - expected object value after '{'");
-
-                        if (chr == '$') // Type specified
-                        {
-                            chr = stream().get();
-                            if (chr == EOF || !strchr(valid_types, chr)) throw core::error("UBJSON - expected type specifier after '$'");
-                            type = chr;
-                            chr = stream().get();
-                            if (chr == EOF) throw core::error("UBJSON - unexpected end of object");
-                        }
-
-                        if (chr == '#') // Count specified
+                        read_container_header(type, size, true);
+                        get_output()->begin_object(core::object_t(), size >= 0? size: core::int_t(core::stream_handler::unknown_size));
+                        if (get_output()->skip_requested())
                         {
-                            chr = stream().get();
-                            if (chr == EOF) throw core::error("UBJSON - expected count specifier after '#'");
-
-                            read_int(size, chr);
-                            if (size < 0) throw core::error("UBJSON - invalid negative size specified for object");
+                            skip_current_value(type, size, true);
+                            get_output()->end_object(core::object_t());
                         }
-
-                        // If type != 0, then size must be >= 0
-                        if (type != 0 && size < 0)
-                            throw core::error("UBJSON - object element type specified but number of elements is not specified");
-                        else if (size < 0) // Unless a count was read, one character needs to be put back (from checking chr == '#')
-                            stream().unget();
-
-                        get_output()->begin_object(core::object_t(), size >= 0? size: core::int_t(core::stream_handler::unknown_size));
-                        containers.push(container_data(type, size));
+                        else
+                            containers.push(container_data(type, size));
 
                         break;
                     }
@@ -417,6 +638,9 @@ namespace cppdatalib
             class stream_writer_base : public core::stream_handler, public core::stream_writer
             {
             public:
+                // Buffered numeric arrays with at least this many elements are written as strongly-typed arrays
+                static const size_t min_optimized_array_size = 4;
+
                 stream_writer_base(core::ostream_handle &stream) : core::stream_writer(stream) {}
 
             protected:
@@ -488,6 +712,134 @@ namespace cppdatalib
                     return stream;
                 }
 
+                // Returns the number of bytes write_int() uses for the value of `i`, excluding the specifier
+                static size_t int_size(core::int_t i)
+                {
+                    if (i >= INT8_MIN && i <= UINT8_MAX)
+                        return 1;
+                    else if (i >= INT16_MIN && i <= INT16_MAX)
+                        return 2;
+                    else if (i >= INT32_MIN && i <= INT32_MAX)
+                        return 4;
+                    return 8;
+                }
+
+                // Returns the element type to use for a strongly-typed (optimized) array containing the elements of `v`,
+                // or 0 if `v` is not an array of at least `min_optimized_array_size` numeric elements of the same type,
+                // or if the strongly-typed array would be larger than the plain array
+                char optimized_array_type(const core::value &v)
+                {
+                    if (!v.is_array() || v.array_size() < min_optimized_array_size)
+                        return 0;
+
+                    const core::array_t &arr = v.get_array_unchecked();
+                    const uint64_t header_size = 5 + int_size(arr.size()); // "[$?#" plus count
+                    uint64_t plain_size = 2; // "[" and "]"
+                    char type;
+                    size_t element_size;
+
+                    if (arr.data().front().is_real())
+                    {
+                        bool single_precision = true;
+
+                        for (auto const &element: arr)
+                        {
+                            if (!element.is_real())
+                                return 0;
+                            else if (core::float_from_ieee_754(core::float_to_ieee_754(static_cast<float>(element.get_real_unchecked()))) != element.get_real_unchecked() &&
+                                     !std::isnan(element.get_real_unchecked()))
+                            {
+                                single_precision = false;
+                                plain_size += 9;
+                            }
+                            else
+                                plain_size += 5;
+                        }
+
+                        type = single_precision? 'd': 'D';
+                        element_size = single_precision? 4: 8;
+                    }
+                    else
+                    {
+                        core::int_t min = std::numeric_limits<core::int_t>::max();
+                        core::int_t max = std::numeric_limits<core::int_t>::min();
+
+                        for (auto const &element: arr)
+                        {
+                            core::int_t i;
+
+                            if (element.is_int())
+                                i = element.get_int_unchecked();
+                            else if (element.is_uint() && element.get_uint_unchecked() <= static_cast<core::uint_t>(std::numeric_limits<core::int_t>::max()))
+                                i = element.get_uint_unchecked();
+                            else
+                                return 0;
+
+                            min = std::min(min, i);
+                            max = std::max(max, i);
+                            plain_size += 1 + int_size(i);
+                        }
+
+                        if (min >= 0 && max <= UINT8_MAX)
+                            type = 'U', element_size = 1;
+                        else if (min >= INT8_MIN && max <= INT8_MAX)
+                            type = 'i', element_size = 1;
+                        else if (min >= INT16_MIN && max <= INT16_MAX)
+                            type = 'I', element_size = 2;
+                        else if (min >= INT32_MIN && max <= INT32_MAX)
+                            type = 'l', element_size = 4;
+                        else
+                            type = 'L', element_size = 8;
+                    }
+
+                    if (header_size + arr.size() * element_size > plain_size)
+                        return 0;
+
+                    return type;
+                }
+
+                // Writes `v` as a strongly-typed array with element type `type` (as returned by optimized_array_type()).
+                // The elements are encoded into a buffer and written in blocks
+                core::ostream &write_optimized_array(core::ostream &stream, const core::value &v, char type)
+                {
+                    const size_t block_size = core::buffer_size / 8;
+                    std::unique_ptr<char []> buffer(new char [block_size * 8]);
+                    const core::array_t &arr = v.get_array_unchecked();
+
+                    stream.put('[').put('$').put(type).put('#');
+                    write_int(stream, arr.size(), true);
+
+                    for (size_t start = 0; start < arr.size(); start += block_size)
+                    {
+                        const size_t end = std::min(arr.size(), start + block_size);
+                        unsigned char *data = reinterpret_cast<unsigned char *>(buffer.get());
+
+                        for (size_t i = start; i < end; ++i)
+                        {
+                            const core::value &element = arr.data()[i];
+                            uint64_t t;
+                            int bytes;
+
+                            switch (type)
+                            {
+                                case 'd': t = core::float_to_ieee_754(static_cast<float>(element.get_real_unchecked())); bytes = 4; break;
+                                case 'D': t = core::double_to_ieee_754(element.get_real_unchecked()); bytes = 8; break;
+                                default:
+                                    t = element.is_int()? static_cast<uint64_t>(element.get_int_unchecked()): element.get_uint_unchecked();
+                                    bytes = type == 'U' || type == 'i'? 1: type == 'I'? 2: type == 'l'? 4: 8;
+                                    break;
+                            }
+
+                            for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+                                *data++ = (t >> shift) & 0xff;
+                        }
+
+                        stream.write(buffer.get(), reinterpret_cast<char *>(data) - buffer.get());
+                    }
+
+                    return stream;
+                }
+
                 core::ostream &write_float(core::ostream &stream, core::real_t f, bool add_specifier, char force_specifier = 0)
                 {
                     const std::string specifiers = "dD";
@@ -528,12 +880,18 @@ namespace cppdatalib
 
         class stream_writer : public impl::stream_writer_base
         {
+            bool skip_elements; // true while the elements of an already written strongly-typed array are being provided
+
         public:
-            stream_writer(core::ostream_handle output) : impl::stream_writer_base(output) {}
+            stream_writer(core::ostream_handle output) : impl::stream_writer_base(output), skip_elements(false) {}
 
             bool requires_prefix_string_size() const {return true;}
 
         protected:
+            void begin_() {skip_elements = false;}
+
+            bool write_(const core::value &, bool) {return skip_elements;}
+
             void begin_key_(const core::value &v)
             {
                 if (!v.is_string())
@@ -550,6 +908,40 @@ namespace cppdatalib
                 write_int(stream(), v.get_uint_unchecked(), true);
             }
             void real_(const core::value &v) {write_float(stream(), v.get_real_unchecked(), true);}
+
+            bool write_array_of_(const int64_t *data, size_t size)
+            {
+                if (!skip_elements)
+                    for (size_t i = 0; i < size; ++i)
+                        write_int(stream(), data[i], true);
+                return true;
+            }
+            bool write_array_of_(const uint64_t *data, size_t size)
+            {
+                if (!skip_elements)
+                    for (size_t i = 0; i < size; ++i)
+                    {
+                        if (data[i] > static_cast<uint64_t>(std::numeric_limits<core::int_t>::max()))
+                            throw core::error("UBJSON - 'integer' value is out of range of output format");
+                        write_int(stream(), data[i], true);
+                    }
+                return true;
+            }
+            bool write_array_of_(const double *data, size_t size)
+            {
+                if (!skip_elements)
+                    for (size_t i = 0; i < size; ++i)
+                        write_float(stream(), data[i], true);
+                return true;
+            }
+            bool write_array_of_(const float *data, size_t size)
+            {
+                if (!skip_elements)
+                    for (size_t i = 0; i < size; ++i)
+                        write_float(stream(), data[i], true);
+                return true;
+            }
+
             void begin_string_(const core::value &v, core::int_t size, bool is_key)
             {
                 if (size == unknown_size)
@@ -561,8 +953,27 @@ namespace cppdatalib
             }
             void string_data_(const core::value &v, bool) {stream().write(v.get_string_unchecked().data(), v.get_string_unchecked().size());}
 
-            void begin_array_(const core::value &, core::int_t, bool) {stream().put('[');}
-            void end_array_(const core::value &, bool) {stream().put(']');}
+            // Arrays are only written as strongly-typed arrays when the entire array is provided (for example, when writing a value, or through a `buffer_filter`),
+            // since the element type must be known before the first element is written. Streamed arrays, including their `write_array_of()` runs, use the plain encoding
+            void begin_array_(const core::value &v, core::int_t size, bool)
+            {
+                char type;
+
+                if (size != unknown_size && v.size() == static_cast<size_t>(size) && (type = optimized_array_type(v)) != 0)
+                {
+                    write_optimized_array(stream(), v, type);
+                    skip_elements = true;
+                }
+                else
+                    stream().put('[');
+            }
+            void end_array_(const core::value &, bool)
+            {
+                if (skip_elements)
+                    skip_elements = false; // Strongly-typed arrays have a count, and no end marker
+                else
+                    stream().put(']');
+            }
 
             void begin_object_(const core::value &, core::int_t, bool) {stream().put('{');}
             void end_object_(const core::value &, bool) {stream().put('}');}